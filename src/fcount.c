@@ -16,26 +16,77 @@
 // -------------------------------------------------------------------------
 #include <stdio.h>
 #include <stdlib.h>
+#include <ctype.h>
+#include <errno.h>
 #include <getopt.h>
+#include <limits.h>
 #include <string.h>
+#include <unistd.h>
 #include "util/darray.h"
 #include "util/dbg.h"
 #include "util/fc_funcs.h"
+#include "util/fc_hist.h"
+#include "util/fc_csv.h"
+#include "util/fc_scan.h"
+#include "util/fc_match.h"
+#include "util/fc_sniff.h"
+#include "util/fc_engine.h"
+#include "util/fc_input.h"
+#include "util/fc_decode.h"
+#include "util/fc_parallel.h"
+#include "util/fc_pool.h"
+#include "util/fc_uring.h"
 #include "util/csv.h"
-#define NUL_REPLACEMENT_CHARACTER 63   // This is a '?'
+#define MIN_BUFFER_SIZE (4 * 1024)
+#define MAX_BUFFER_SIZE (1024 * 1024 * 1024)
+#define MAX_JOBS 1024
 
 static const char *program_name = "fcount";
-static unsigned int fieldcount = 0;
-static unsigned long linecount = 0;
+static int be_quiet = 0;
+static int csv_mode = 0;
+static int count_lines = 0;
 static char *delim_arg = "\t";
 static char *delim = "\t";
 static char delim_csv = CSV_COMMA;
 static char *quote_arg = NULL;
 static char quote = CSV_QUOTE;
+static char *engine_arg = NULL;
+static size_t buffer_size = FC_INPUT_BUFSIZE;
+static size_t max_memory = 0;       // with --max-memory, the most the read buffers and decoders may take
+static int io_depth = FC_URING_DEPTH;   // files opened and read ahead (--io-depth)
+static FC_uring *uring = NULL;      // the files being opened and read ahead, if any
+static int jobs = 1;
+static int file_jobs = 1;   // threads per file (-j, unless counting several files at once)
+static char *save_arg = NULL;
+static FC_hist **saved = NULL;  // with --save, the histogram of each FILE
+static int fail_fast = 0;       // stop at the second field count (-q)
+static unsigned long expect = 0;    // with --expect, the field count every record must have
+static FILE *all_fp = NULL;         // with --all, where every violation is written
+static int sniff_mode = 0;
+static char *sniff_delims = FC_SNIFF_DEFAULT;
+static size_t sniff_size = 0;       // with --sniff=SIZE, how much of each FILE to look at
+
+// Long options that have no short equivalent:
+enum {
+    ENGINE_OPTION = CHAR_MAX + 1,
+    PRINT_ENGINE_OPTION,
+    BUFFER_SIZE_OPTION,
+    UNORDERED_OPTION,
+    SAVE_OPTION,
+    MERGE_OPTION,
+    EXPECT_OPTION,
+    ALL_OPTION,
+    MAX_MEMORY_OPTION,
+    IO_DEPTH_OPTION,
+    SNIFF_OPTION
+};
 
-// The callbacks for CSV processing:
-void cb1 (void *s, size_t len, void *data);
-void cb2 (int c, void *data);
+// The records of one file found to violate --expect:
+struct violations {
+    char *filename;
+    FILE *out;                  // where the first one is printed
+    unsigned long long count;
+};
 
 static void try_help (int status) {
     printf("Try '%s --help' for more information.\n", program_name);
@@ -66,8 +117,56 @@ More than one FILE can be specified.\n\
   -q, --quiet            do not output counts, but return 2 if\n\
                          multiple field counts are detected\n\
                          (i.e. the file is inconsistent)\n\
+  -j, --jobs=N           use N threads: count several FILEs at once, or\n\
+                         split a single (regular) FILE between them\n\
+      --unordered        with -j, print the counts of each FILE as soon as\n\
+                         it is done, instead of in the order given\n\
   -C, --csv              parse CSV files\n\
   -Q, --csv-quote        CSV quoting character (ignored unless --csv)\n\
+      --save=HFILE       also save the field counts of all the FILEs,\n\
+                         added up, to HFILE (in a compact binary format)\n\
+      --merge            the FILEs are histograms saved with --save: add\n\
+                         them up and print the total (under the name of\n\
+                         the first one)\n\
+      --expect=N         check that every record has N fields instead of\n\
+                         counting them: print the line number, byte offset\n\
+                         (from 0) and field count of the first record that\n\
+                         doesn't, and return 2 if there is one (with\n\
+                         --csv, the line a record starts on)\n\
+      --all=VFILE        with --expect, don't stop at the first violation,\n\
+                         and write every one of them to VFILE\n\
+      --sniff[=SIZE]     try every byte of DELIM as the delimiter (by\n\
+                         default: comma, TAB, '|' and ';'), plain and with\n\
+                         --csv, in one pass over the first SIZE bytes of\n\
+                         each FILE (or all of it), and print the options for\n\
+                         each, best first, with their most common field\n\
+                         count and the share (%%) of records that have it\n\
+      --buffer-size=SIZE read input in blocks of SIZE bytes (a K, M or G\n\
+                         suffix may be used; the default is 1M)\n\
+      --max-memory=SIZE  keep the read buffers and decompressors of all\n\
+                         threads within SIZE bytes, however long the lines\n\
+                         are (the blocks are made smaller if need be; an xz\n\
+                         or zstd FILE that needs more to decompress is an\n\
+                         error)\n\
+      --io-depth=N       with several FILEs (and no -j), open and read up\n\
+                         to N of them ahead with io_uring (the default is\n\
+                         8; 0 opens them one at a time)\n\
+      --engine=NAME      use the NAME scanning engine (scalar, sse2, sse4.2,\n\
+                         avx2, avx512bw) instead of the best one the CPU\n\
+                         supports\n\
+      --print-engine     print the CPU features detected and the scanning\n\
+                         engine in use, then exit\n\
+");
+
+      printf ("\
+\n\
+FILEs compressed with gzip, bzip2, xz or zstd are decompressed as they\n\
+are read (if fcount was built with the library for the format).  With -j,\n\
+a single BGZF FILE (as bgzip writes it), or zstd FILE of many frames (or\n\
+in the seekable format), is decompressed on all N threads.\n\
+\n\
+NUL bytes are read as data like any other byte, so a '?' in DELIM does\n\
+not match them (as it did in earlier versions of fcount).\n\
 ");
     }
 
@@ -81,184 +180,590 @@ static struct option long_options[] = {
     {"header",     no_argument,       0, 'H'},
     {"delimiter",  required_argument, 0, 'd'},
     {"line-count", no_argument,       0, 'l'},
+    {"jobs",       required_argument, 0, 'j'},
     {"csv-quote",  required_argument, 0, 'Q'},
+    {"engine",     required_argument, 0, ENGINE_OPTION},
+    {"print-engine", no_argument,     0, PRINT_ENGINE_OPTION},
+    {"buffer-size", required_argument, 0, BUFFER_SIZE_OPTION},
+    {"max-memory", required_argument, 0, MAX_MEMORY_OPTION},
+    {"io-depth",   required_argument, 0, IO_DEPTH_OPTION},
+    {"unordered",  no_argument,       0, UNORDERED_OPTION},
+    {"save",       required_argument, 0, SAVE_OPTION},
+    {"merge",      no_argument,       0, MERGE_OPTION},
+    {"expect",     required_argument, 0, EXPECT_OPTION},
+    {"all",        required_argument, 0, ALL_OPTION},
+    {"sniff",      optional_argument, 0, SNIFF_OPTION},
     {"help",       no_argument,       0, 'h'},
     {0, 0, 0, 0}
 };
 
 
-static void replace_nulls(char *line, ssize_t bytes_read)
+// Parse a byte count with an optional K, M or G (binary) suffix:
+static int parse_size(const char *arg, size_t *size)
 {
-    for (ssize_t i = 0; i < bytes_read; i++) {
-        if ( line[i] == 0 ) { line[i] = NUL_REPLACEMENT_CHARACTER; }
+    char *end = NULL;
+    unsigned long long n = 0;
+    int shift = 0;
+
+    // strtoull() would skip leading blanks and take a sign (wrapping "-1"):
+    check(isdigit((unsigned char)arg[0]), "ERROR: invalid size: %s", arg);
+
+    errno = 0;
+    n = strtoull(arg, &end, 10);
+    check(errno == 0 && end != arg, "ERROR: invalid size: %s", arg);
+
+    switch (*end) {
+        case 'k': case 'K': shift = 10; end++; break;
+        case 'm': case 'M': shift = 20; end++; break;
+        case 'g': case 'G': shift = 30; end++; break;
     }
+
+    check(*end == '\0', "ERROR: invalid size: %s", arg);
+    check(n <= ((size_t)-1 >> shift), "ERROR: size too large: %s", arg);
+
+    n <<= shift;
+
+    *size = n;
+    return 0;
+
+error:
+    return -1;
 }
 
-/* Return the number of delimiters in a string */
-static unsigned int dcount(char *line, char *delim, const int dlen, ssize_t bytes_read)
+// Parse a count of at most MAX:
+static int parse_count(const char *arg, unsigned long max, unsigned long *count)
 {
-    int dc = 0;  // The delimiter count
-    char *p = line;
+    char *end = NULL;
+    unsigned long n = 0;
+
+    // strtoul() would skip leading blanks and take a sign (wrapping "-1"):
+    check(isdigit((unsigned char)arg[0]), "ERROR: invalid number: %s", arg);
 
-    // A smaller strlen tells us we have NULs in the line string:
-    if ( strlen(line) < (size_t)bytes_read ) { replace_nulls(line, bytes_read); }
+    errno = 0;
+    n = strtoul(arg, &end, 10);
+    check(errno == 0 && end != arg && *end == '\0', "ERROR: invalid number: %s", arg);
+    check(n <= max, "ERROR: number too large: %s", arg);
 
-    while((p = strstr(p, delim)))
-    {
-       dc++;
-       p += dlen;
+    *count = n;
+    return 0;
+
+error:
+    return -1;
+}
+
+// Open FILENAME for input, taking it from the files read ahead if it's one
+// of them (a compressed file in chunks is decoded on the -j threads):
+static int input_open(FC_input *in, char *filename)
+{
+    if (uring) {
+        return FC_uring_open(uring, filename, in);
     }
 
-    return dc;
+    return FC_input_open_jobs(in, filename, buffer_size, file_jobs);
 }
 
-int file_count(char *filename, DArray *darray)
+/* With -q only the exit status matters, so a file needn't be read any
+   further once it has two field counts */
+#define known_inconsistent(H) (fail_fast && FC_hist_distinct(H) > 1)
+
+/* Count a file with a single-byte delimiter a block at a time, scanning
+   the mapped file (or the read buffer) with the kernels in fc_scan.c.  A
+   mapped file may be split across several threads (-j) */
+static int file_count_scan(char *filename, FC_hist *hist)
 {
-    char *line = NULL;
-    FILE *fp = NULL;
-    size_t len = 0;         // allocated size for line
+    FC_input in;
+    FC_scan s;
+    const char *block = NULL;
     ssize_t bytes_read = 0; // num of chars read
-    const unsigned int dlen = strlen(delim);
 
-    if (filename[0] == '-') {
-        fp = stdin;
-    }
-    else {
-        fp = fopen(filename, "rb");
+    check(input_open(&in, filename) == 0, "Error opening file: %s.", filename);
+
+    if (file_jobs > 1 && in.mapped) {
+        check(FC_parallel_scan(in.data, in.size, (unsigned char)delim[0], file_jobs, buffer_size, fail_fast, hist) == 0, "Error counting file: %s.", filename);
+        FC_input_close(&in);
+        return 0;
     }
 
-    check(fp != NULL, "Error opening file: %s.", filename);
+    FC_scan_init(&s, (unsigned char)delim[0]);
 
-    while ((bytes_read = getline(&line, &len, fp)) != -1) {
+    while ((bytes_read = FC_input_next(&in, &block, 0)) > 0) {
+        check(FC_scan_block(&s, block, bytes_read, hist) == 0, "Error counting block.");
 
-        // fieldcount = dcount(line, delim) + 1;
-        check(FC_array_push(darray, dcount(line, delim, dlen, bytes_read) + 1) == 0, "Error pushing element into darray.");
+        if (known_inconsistent(hist)) {
+            FC_input_close(&in);
+            return 0;
+        }
     }
 
-    free(line);
-    fclose(fp);
+    check(bytes_read == 0, "Error reading file: %s.", filename);
+    check(FC_scan_finish(&s, hist) == 0, "Error counting record.");
+
+    FC_input_close(&in);
 
     return 0;
 
 error:
+    FC_input_close(&in);
     return -1;
 }
 
-int line_count(char *filename)
+/* Report a record with the wrong field count (--expect): the first one of
+   a file is printed, and with --all every one is written to the --all file.
+   Returns nonzero to stop at the first one */
+static int report_violation(void *data, unsigned long long line, unsigned long long offset, unsigned long fieldcount)
 {
-    char *line = NULL;
-    FILE *fp = NULL;
-    size_t len = 0;         // allocated size for line
+    struct violations *v = data;
+
+    if (v->count++ == 0 && !be_quiet) {
+        fprintf(v->out, "%llu\t%llu\t%lu\t%s\n", line, offset, fieldcount, v->filename);
+    }
+
+    if (all_fp) {
+        fprintf(all_fp, "%llu\t%llu\t%lu\t%s\n", line, offset, fieldcount, v->filename);
+        return 0;
+    }
+
+    return 1;
+}
+
+/* Check that every record of a file with a single-byte delimiter has the
+   expected number of fields, with the validating kernels in fc_scan.c */
+static int file_expect_scan(char *filename, struct violations *v)
+{
+    FC_input in;
+    FC_scan s;
+    const char *block = NULL;
     ssize_t bytes_read = 0; // num of chars read
-    const unsigned int dlen = strlen(delim);
 
-    if (filename[0] == '-') {
-        fp = stdin;
+    check(input_open(&in, filename) == 0, "Error opening file: %s.", filename);
+
+    FC_expect_init(&s, (unsigned char)delim[0], expect, report_violation, v);
+
+    while ((bytes_read = FC_input_next(&in, &block, 0)) > 0) {
+        if (FC_expect_block(&s, block, bytes_read) != 0) {
+            FC_input_close(&in);
+            return 0;
+        }
+    }
+
+    check(bytes_read == 0, "Error reading file: %s.", filename);
+    FC_expect_finish(&s);
+
+    FC_input_close(&in);
+
+    return 0;
+
+error:
+    FC_input_close(&in);
+    return -1;
+}
+
+/* Count a file with a compound delimiter (or, given V, check it against
+   --expect), with the matching kernels in fc_match.c.  Only the last few
+   bytes of a block (which may start a delimiter) are carried over to the
+   next one, so memory use doesn't depend on the length of the lines */
+static int file_count_lines(char *filename, FC_hist *hist, struct violations *v)
+{
+    FC_input in;
+    FC_match m;
+    const char *block = NULL;
+    ssize_t bytes_read = 0; // num of chars read, including those carried over
+    size_t keep = 0;        // num of chars carried over to the next block
+    int rc = 0;
+
+    check(input_open(&in, filename) == 0, "Error opening file: %s.", filename);
+
+    if (v) {
+        check(FC_match_expect_init(&m, delim, expect, report_violation, v) == 0, "Error starting scan.");
     }
     else {
-        fp = fopen(filename, "rb");
+        check(FC_match_init(&m, delim) == 0, "Error starting scan.");
     }
 
-    check(fp != NULL, "Error opening file: %s.", filename);
+    while ((bytes_read = FC_input_next(&in, &block, keep)) > (ssize_t)keep) {
+        rc = FC_match_block(&m, block, bytes_read, &keep, hist);
+        check(rc >= 0, "Error counting block.");
 
-    while ((bytes_read = getline(&line, &len, fp)) != -1) {
-        linecount++;
+        if (rc > 0 || (hist && known_inconsistent(hist))) {
+            FC_input_close(&in);
+            return 0;
+        }
     }
 
-    free(line);
-    fclose(fp);
+    check(bytes_read >= 0, "Error reading file: %s.", filename);
+    check(FC_match_finish(&m, hist) >= 0, "Error counting record.");
+
+    FC_input_close(&in);
 
     return 0;
 
 error:
+    FC_input_close(&in);
     return -1;
 }
 
-// Callback 1 for CSV support, called whenever a field is processed:
-void cb1 (void *s, size_t len, void *data)
+int file_count(char *filename, FC_hist *hist)
 {
-    fieldcount++;
+    if (strlen(delim) == 1) {
+        return file_count_scan(filename, hist);
+    }
+
+    return file_count_lines(filename, hist, NULL);
+}
+
+int file_expect(char *filename, struct violations *v)
+{
+    if (strlen(delim) == 1) {
+        return file_expect_scan(filename, v);
+    }
+
+    return file_count_lines(filename, NULL, v);
 }
 
-// Callback 2 for CSV support, called whenever a record is processed:
-void cb2 (int c, void *data)
+int line_count(char *filename, unsigned long *linecount)
 {
-    check(FC_array_push((DArray *)data, fieldcount) == 0, "Error pushing element into darray.");
-    fieldcount = 0;
+    FC_input in;
+    const char *block = NULL;
+    ssize_t bytes_read = 0; // num of chars read
+    char last = '\n';       // the last byte of the input
 
-    return;
+    check(input_open(&in, filename) == 0, "Error opening file: %s.", filename);
+
+    while ((bytes_read = FC_input_next(&in, &block, 0)) > 0) {
+        *linecount += FC_scan_lines(block, bytes_read);
+        last = block[bytes_read - 1];
+    }
+
+    check(bytes_read == 0, "Error reading file: %s.", filename);
+
+    // Like getline, count a last line that has no newline:
+    if (last != '\n') {
+        (*linecount)++;
+    }
+
+    FC_input_close(&in);
+
+    return 0;
 
 error:
-    exit(1);
+    FC_input_close(&in);
+    return -1;
 }
 
-int file_count_csv(char *filename, DArray *darray)
+/* Count a CSV file with the counting-only parser in fc_csv.c, which gives
+   the field counts libcsv would, without copying any field.  A mapped file
+   may be split across several threads (-j) */
+int file_count_csv(char *filename, FC_hist *hist)
 {
-    struct csv_parser p;
-    char buf[1024];
-    FILE *fp = NULL;
-    size_t bytes_read = 0; // num of chars read
+    FC_csv csv;
+    FC_input in;
+    const char *block = NULL;
+    ssize_t bytes_read = 0; // num of chars read
+
+    check(input_open(&in, filename) == 0, "Error opening file: %s.", filename);
 
-    if (filename[0] == '-') {
-        fp = stdin;
+    if (file_jobs > 1 && in.mapped) {
+        check(FC_parallel_csv(in.data, in.size, delim_csv, quote, file_jobs, buffer_size, hist, NULL) == 0, "Error counting CSV file: %s.", filename);
+        FC_input_close(&in);
+        return 0;
     }
-    else {
-        fp = fopen(filename, "rb");
+
+    FC_csv_init(&csv, delim_csv, quote);
+
+    while ((bytes_read = FC_input_next(&in, &block, 0)) > 0) {
+        check(FC_csv_block(&csv, block, bytes_read, hist) == 0, "Error counting block.");
+
+        if (known_inconsistent(hist)) {
+            FC_input_close(&in);
+            return 0;
+        }
     }
 
-    check(fp != NULL, "Error opening file: %s.", filename);
-    check(csv_init(&p, 0) == 0, "Error initializing CSV parser.");
+    check(bytes_read == 0, "Error reading file: %s.", filename);
+    check(FC_csv_finish(&csv, hist) == 0, "Error counting record.");
+    FC_input_close(&in);
+
+    return 0;
 
-    csv_set_delim(&p, delim_csv);
-    csv_set_quote(&p, quote);
+error:
+    FC_input_close(&in);
+    return -1;
+}
+
+/* Check that every row of a CSV file has the expected number of fields,
+   with the state machine in fc_csv.c */
+static int file_expect_csv(char *filename, struct violations *v)
+{
+    FC_csv csv;
+    FC_input in;
+    const char *block = NULL;
+    ssize_t bytes_read = 0; // num of chars read
 
-    while ((bytes_read=fread(buf, 1, 1024, fp)) > 0) {
-        check(csv_parse(&p, buf, bytes_read, cb1, cb2, darray) == bytes_read, "Error while parsing file: %s", csv_strerror(csv_error(&p)));
+    check(input_open(&in, filename) == 0, "Error opening file: %s.", filename);
+
+    FC_csv_expect_init(&csv, delim_csv, quote, expect, report_violation, v);
+
+    while ((bytes_read = FC_input_next(&in, &block, 0)) > 0) {
+        if (FC_csv_expect_block(&csv, block, bytes_read) != 0) {
+            FC_input_close(&in);
+            return 0;
+        }
     }
 
-    check(csv_fini(&p, cb1, cb2, darray) == 0, "Error finishing CSV processing.");
-    csv_free(&p);
-    fclose(fp);
+    check(bytes_read == 0, "Error reading file: %s.", filename);
+    FC_csv_expect_finish(&csv);
+
+    FC_input_close(&in);
 
     return 0;
 
 error:
+    FC_input_close(&in);
     return -1;
 }
 
-// Line-count Callback 2 for CSV support, called whenever a record is processed:
-void cb2_lines (int c, void *data)
+int line_count_csv(char *filename, unsigned long *linecount)
 {
-    linecount++;
+    FC_csv csv;
+    FC_input in;
+    const char *block = NULL;
+    ssize_t bytes_read = 0; // num of chars read
+    unsigned long long rows = 0;
+
+    check(input_open(&in, filename) == 0, "Error opening file: %s.", filename);
+
+    if (file_jobs > 1 && in.mapped) {
+        check(FC_parallel_csv(in.data, in.size, delim_csv, quote, file_jobs, buffer_size, NULL, &rows) == 0, "Error counting CSV file: %s.", filename);
+        FC_input_close(&in);
+        *linecount = rows;
+        return 0;
+    }
+
+    FC_csv_init(&csv, delim_csv, quote);
+
+    while ((bytes_read = FC_input_next(&in, &block, 0)) > 0) {
+        FC_csv_block(&csv, block, bytes_read, NULL);
+    }
+
+    check(bytes_read == 0, "Error reading file: %s.", filename);
+    FC_csv_finish(&csv, NULL);
+    FC_input_close(&in);
+
+    *linecount = csv.rows;
+
+    return 0;
+
+error:
+    FC_input_close(&in);
+    return -1;
 }
 
-int line_count_csv(char *filename)
+// Write the options that count as candidate C does to BUF, quoted for the
+// shell:
+static void sniff_options(char *buf, size_t size, const FC_sniff_candidate *c)
 {
-    struct csv_parser p;
-    char buf[1024];
-    FILE *fp = NULL;
-    size_t bytes_read = 0; // num of chars read
+    const char *csv = c->csv ? "-C " : "";
 
-    if (filename[0] == '-') {
-        fp = stdin;
+    if (c->delim == '\t') {
+        snprintf(buf, size, "%s-d $'\\t'", csv);
+    }
+    else if (c->delim == '\'') {
+        snprintf(buf, size, "%s-d \"'\"", csv);
+    }
+    else if (c->delim < ' ' || c->delim > '~') {
+        snprintf(buf, size, "%s-d $'\\x%02x'", csv, c->delim);
     }
     else {
-        fp = fopen(filename, "rb");
+        snprintf(buf, size, "%s-d '%c'", csv, c->delim);
     }
+}
 
-    check(fp != NULL, "Error opening file: %s.", filename);
-    check(csv_init(&p, 0) == 0, "Error initializing CSV parser.");
+/* Count a file with every candidate of --sniff at once (see fc_sniff.c),
+   and print them best first, with their most common field count and the
+   share of records that have it.  Only the first sniff_size bytes are read
+   if given, and the record they cut short isn't counted.  Returns 2 if not
+   even the best candidate is consistent, 0 if it is, or -1 on error */
+static int file_sniff(char *filename, FILE *out)
+{
+    FC_sniff_candidate *ranked[2 * FC_SNIFF_DELIMS];
+    FC_sniff *s = NULL;
+    FC_input in;
+    const char *block = NULL;
+    ssize_t bytes_read = 0; // num of chars read
+    size_t total = 0;
+    char options[32];
+    int opened = 0;
+    int cut = 0;
+    int n = 0;
+    int i = 0;
+
+    s = FC_sniff_create(sniff_delims, quote);
+    check_debug(s != NULL, "Error counting file: %s.", filename);
+
+    check(input_open(&in, filename) == 0, "Error opening file: %s.", filename);
+    opened = 1;
+
+    // Only input past the first sniff_size bytes cuts the last record
+    // short, so a block is read past them (if there's one) to find out:
+    while (!cut && (bytes_read = FC_input_next(&in, &block, 0)) > 0) {
+        if (sniff_size && total + bytes_read > sniff_size) {
+            bytes_read = sniff_size - total;
+            cut = 1;
+        }
+
+        if (bytes_read > 0) {
+            check(FC_sniff_block(s, block, bytes_read) == 0, "Error counting block.");
+        }
+        total += bytes_read;
+    }
+
+    check(bytes_read >= 0, "Error reading file: %s.", filename);
+    if (!cut) {
+        check(FC_sniff_finish(s) == 0, "Error counting record.");
+    }
+    FC_input_close(&in);
+
+    n = FC_sniff_rank(s, ranked);
+
+    for (i = 0; i < n && !be_quiet; i++) {
+        sniff_options(options, sizeof(options), ranked[i]);
+        fprintf(out, "%s\t%lu\t%.2f\t%s\n", options, ranked[i]->fieldcount,
+                ranked[i]->records ? 100.0 * ranked[i]->consistent / ranked[i]->records : 0.0, filename);
+    }
+
+    i = (ranked[0]->consistent < ranked[0]->records) ? 2 : 0;
+    FC_sniff_destroy(s);
+
+    return i;
+
+error:
+    if (opened) FC_input_close(&in);
+    FC_sniff_destroy(s);
+    return -1;
+}
+
+// Print the counts in HIST under FILENAME, returning 2 if there is more than
+// one field count (0 if not), or -1 on error:
+static int print_hist(FC_hist *hist, char *filename, FILE *out)
+{
+    DArray *darray = NULL;
 
-    csv_set_delim(&p, delim_csv);
-    csv_set_quote(&p, quote);
+    if (!be_quiet) {
+        darray = DArray_create(sizeof(FCount), 10);
+        check_mem(darray);
+        check(FC_hist_to_array(hist, darray) == 0, "Error collecting field counts.");
 
-    while ((bytes_read=fread(buf, 1, 1024, fp)) > 0) {
-        check(csv_parse(&p, buf, bytes_read, NULL, cb2_lines, NULL) == bytes_read, "Error while parsing file: %s", csv_strerror(csv_error(&p)));
+        FC_array_sort(darray, FC_cmp);
+        FC_array_fprint(out, darray, filename);
+        FC_array_destroy(darray);
     }
 
-    check(csv_fini(&p, NULL, cb2_lines, NULL) == 0, "Error finishing CSV processing.");
-    csv_free(&p);
-    fclose(fp);
+    return FC_hist_distinct(hist) > 1 ? 2 : 0;
+
+error:
+    if (darray) FC_array_destroy(darray);
+    return -1;
+}
+
+/* Count one file and write its counts to OUT, handing the histogram over to
+   *KEEP unless KEEP is NULL.  Returns 2 if the file is inconsistent (has more
+   than one field count), 0 if not, or -1 on error */
+static int count_file(char *filename, FILE *out, FC_hist **keep)
+{
+    FC_hist *hist = NULL;
+    unsigned long linecount = 0;
+    int inconsistent = 0;
+
+    if (count_lines) {
+
+        if (csv_mode) {
+            check(line_count_csv(filename, &linecount) == 0, "Error counting CSV file: %s", filename);
+        }
+        else {
+            check(line_count(filename, &linecount) == 0, "Error counting file: %s", filename);
+        }
+        fprintf(out, "%ld\t%s\n", linecount, filename);
+    }
+    else if (sniff_mode) {
+        inconsistent = file_sniff(filename, out);
+        check_debug(inconsistent >= 0, "Error counting file: %s", filename);
+    }
+    else if (expect) {
+        struct violations v = { filename, out, 0 };
+
+        if (csv_mode) {
+            check(file_expect_csv(filename, &v) == 0, "Error checking CSV file: %s", filename);
+        }
+        else {
+            check(file_expect(filename, &v) == 0, "Error checking file: %s", filename);
+        }
+
+        // Any record with the wrong field count makes it inconsistent:
+        inconsistent = (v.count > 0) ? 2 : 0;
+    }
+    else {
+        // The histogram that will hold all field counts:
+        hist = FC_hist_create();
+        check_mem(hist);
+
+        // Count the file:
+        if (csv_mode) {
+            check(file_count_csv(filename, hist) == 0, "Error counting CSV file: %s", filename);
+        }
+        else {
+            check(file_count(filename, hist) == 0, "Error counting file: %s", filename);
+        }
+
+        // Print the counts (more than one field count makes it inconsistent):
+        inconsistent = print_hist(hist, filename, out);
+        check_debug(inconsistent >= 0, "Error printing field counts.");
+
+        if (keep) {
+            *keep = hist;
+        }
+        else {
+            FC_hist_destroy(hist);
+        }
+    }
+
+    return inconsistent;
+
+error:
+    if (hist) FC_hist_destroy(hist);
+    return -1;
+}
+
+// Worker-pool wrapper around count_file() for the FILE arguments:
+static int count_file_job(int item, FILE *out, void *data)
+{
+    return count_file(((char **)data)[item], out, saved ? &saved[item] : NULL);
+}
+
+// Add the histogram saved in FILENAME ("-" is the standard input) to HIST:
+static int load_hist(FC_hist *hist, char *filename)
+{
+    FILE *fp = (filename[0] == '-') ? stdin : fopen(filename, "rb");
+
+    check(fp != NULL, "Error opening file: %s.", filename);
+    check(FC_hist_load(hist, fp) == 0, "Error reading histogram: %s.", filename);
+
+    if (fp != stdin) fclose(fp);
+
+    return 0;
+
+error:
+    if (fp && fp != stdin) fclose(fp);
+    return -1;
+}
+
+// Save HIST to FILENAME:
+static int save_hist(FC_hist *hist, char *filename)
+{
+    FILE *fp = fopen(filename, "wb");
+
+    check(fp != NULL, "Error opening file: %s.", filename);
+    check(FC_hist_save(hist, fp) == 0, "Error saving histogram: %s.", filename);
+    check(fclose(fp) == 0, "Error writing file: %s.", filename);
 
     return 0;
 
@@ -266,22 +771,66 @@ error:
     return -1;
 }
 
+/* Add up NFILES histograms: the HISTS counted, or else those saved in FILES
+   (whose total is printed under the first name).  The total is saved if
+   asked to (with --save).  Returns the status of print_hist() */
+static int merge_hists(FC_hist **hists, char **files, int nfiles, FILE *out)
+{
+    FC_hist *total = FC_hist_create();
+    int status = 0;
+    int i = 0;
+
+    check_mem(total);
+
+    for (i = 0; i < nfiles; i++) {
+        if (hists) {
+            check(FC_hist_merge(total, hists[i]) == 0, "Error merging field counts.");
+        }
+        else {
+            check(load_hist(total, files[i]) == 0, "Error merging file: %s", files[i]);
+        }
+    }
+
+    if (files) {
+        status = print_hist(total, files[0], out);
+        check_debug(status >= 0, "Error printing field counts.");
+    }
+
+    if (save_arg) {
+        check(save_hist(total, save_arg) == 0, "Error saving field counts.");
+    }
+
+    FC_hist_destroy(total);
+
+    return status;
+
+error:
+    if (total) FC_hist_destroy(total);
+    return -1;
+}
+
 int main (int argc, char *argv[])
 {
     int c;
-    int be_quiet = 0;
-    int csv_mode = 0;
     int show_header = 0;
-    int count_lines = 0;
+    int unordered = 0;
     int inconsistent_file = 0;
+    int status = 0;
     int delim_arg_flag = 0;
+    int max_memory_flag = 0;
+    int print_engine = 0;
+    int merge_mode = 0;
+    int nfiles = 0;
+    int i = 0;
+    unsigned long count = 0;
+    char *all_arg = NULL;
 
     while (1) {
 
         // getopt_long stores the option index here.
         int option_index = 0;
 
-        c = getopt_long (argc, argv, "hHClqd:Q:", long_options, &option_index);
+        c = getopt_long (argc, argv, "hHClqd:Q:j:", long_options, &option_index);
 
         // Detect the end of the options.
         if (c == -1) break;
@@ -329,6 +878,74 @@ int main (int argc, char *argv[])
                 be_quiet = 1;
                 break;
 
+            case 'j':
+                debug("option -j with value `%s'", optarg);
+                check(parse_count(optarg, MAX_JOBS, &count) == 0 && count >= 1, "ERROR: the number of jobs must be between 1 and %d", MAX_JOBS);
+                jobs = count;
+                break;
+
+            case ENGINE_OPTION:
+                debug("option --engine with value `%s'", optarg);
+                engine_arg = optarg;
+                break;
+
+            case PRINT_ENGINE_OPTION:
+                debug("option --print-engine");
+                print_engine = 1;
+                break;
+
+            case UNORDERED_OPTION:
+                debug("option --unordered");
+                unordered = 1;
+                break;
+
+            case SAVE_OPTION:
+                debug("option --save with value `%s'", optarg);
+                save_arg = optarg;
+                break;
+
+            case MERGE_OPTION:
+                debug("option --merge");
+                merge_mode = 1;
+                break;
+
+            case EXPECT_OPTION:
+                debug("option --expect with value `%s'", optarg);
+                check(parse_count(optarg, ULONG_MAX, &expect) == 0, "Try '%s --help' for more information.", program_name);
+                check(expect >= 1, "ERROR: the expected field count must be at least 1");
+                break;
+
+            case ALL_OPTION:
+                debug("option --all with value `%s'", optarg);
+                all_arg = optarg;
+                break;
+
+            case BUFFER_SIZE_OPTION:
+                debug("option --buffer-size with value `%s'", optarg);
+                check(parse_size(optarg, &buffer_size) == 0, "Try '%s --help' for more information.", program_name);
+                check(buffer_size >= MIN_BUFFER_SIZE && buffer_size <= MAX_BUFFER_SIZE, "ERROR: size must be between 4K and 1G: %s", optarg);
+                break;
+
+            case MAX_MEMORY_OPTION:
+                debug("option --max-memory with value `%s'", optarg);
+                check(parse_size(optarg, &max_memory) == 0, "Try '%s --help' for more information.", program_name);
+                max_memory_flag = 1;
+                break;
+
+            case SNIFF_OPTION:
+                debug("option --sniff with value `%s'", optarg ? optarg : "");
+                sniff_mode = 1;
+                if (optarg) {
+                    check(parse_size(optarg, &sniff_size) == 0 && sniff_size > 0, "Try '%s --help' for more information.", program_name);
+                }
+                break;
+
+            case IO_DEPTH_OPTION:
+                debug("option --io-depth with value `%s'", optarg);
+                check(parse_count(optarg, MAX_JOBS, &count) == 0, "ERROR: the I/O depth must be between 0 and %d", MAX_JOBS);
+                io_depth = count;
+                break;
+
             case ':':   /* missing option argument */
                 fprintf(stderr, "%s: option '-%c' requires an argument\n",
                         argv[0], optopt);
@@ -344,7 +961,21 @@ int main (int argc, char *argv[])
         }
     }
 
-    if (csv_mode && delim_arg_flag) {
+    // Bind the scanning kernels for this CPU (or the one asked for):
+    check(FC_engine_select(engine_arg) == 0, "Try '%s --print-engine' for the engines available.", program_name);
+
+    if (print_engine) {
+        FC_engine_print(stdout);
+        return 0;
+    }
+
+    check(delim_arg[0] != '\0', "ERROR: the delimiter can't be empty");
+
+    if (sniff_mode) {
+        check(!count_lines && !csv_mode && !expect && !save_arg && !merge_mode, "ERROR: --sniff cannot be used with -l, --csv, --expect, --save or --merge");
+        if (delim_arg_flag) sniff_delims = delim_arg;
+    }
+    else if (csv_mode && delim_arg_flag) {
         check(strlen(delim_arg) == 1, "ERROR: CSV delimiter must be exactly one byte long");
         delim_csv = delim_arg[0];
     }
@@ -352,77 +983,137 @@ int main (int argc, char *argv[])
         delim = delim_arg;
     }
 
+    check(!(count_lines && (save_arg || merge_mode)), "ERROR: --save and --merge cannot be used with -l");
+
+    if (expect || all_arg) {
+        check(expect, "ERROR: --all can only be used with --expect");
+        check(!count_lines && !save_arg && !merge_mode, "ERROR: --expect cannot be used with -l, --save or --merge");
+    }
+
+    if (all_arg) {
+        all_fp = fopen(all_arg, "w");
+        check(all_fp != NULL, "Error opening file: %s.", all_arg);
+    }
+
+    // Every thread's input takes a few blocks (see FC_INPUT_MAX_BLOCKS), and
+    // files read ahead take a block each, and one more for the file being
+    // counted.  No line is ever held whole, so smaller blocks keep to
+    // --max-memory.  Half of each job's share goes to its blocks, and the
+    // other half to decompressing its input, which an xz or zstd file may
+    // need a lot of (see fc_decode.c).  --max-memory=0 is refused as too
+    // small, not taken to mean no cap:
+    if (max_memory_flag) {
+        long pagesize = sysconf(_SC_PAGESIZE);
+        int blocks = FC_INPUT_MAX_BLOCKS + (io_depth ? io_depth + 1 : 0);
+        size_t most = max_memory / jobs / 2 / blocks;
+
+        if (pagesize <= 0) pagesize = 4096;
+        most -= most % pagesize;
+        check(most >= MIN_BUFFER_SIZE, "ERROR: --max-memory must be at least %dK per job", 2 * blocks * MIN_BUFFER_SIZE / 1024);
+        if (buffer_size > most) buffer_size = most;
+        debug("buffer size: %zu", buffer_size);
+
+        FC_decode_limit(max_memory / jobs / 2);
+    }
+
+    // Quiet counts only decide the exit status (unless they're saved):
+    fail_fast = be_quiet && !save_arg;
+
     if (show_header && !be_quiet) {
         if (count_lines) {
             printf("records\tfile\n");
         }
+        else if (sniff_mode) {
+            printf("options\tfield_count\tconsistency\tfile\n");
+        }
+        else if (expect) {
+            printf("line\toffset\tfield_count\tfile\n");
+        }
         else {
             printf("field_count\trecords\tfile\n");
         }
     }
 
-    int j = optind;  // A copy of optind (the number of options at the command-line),
-                     // which is not the same as argc, as that counts ALL
-                     // arguments.  (optind <= argc).
+    nfiles = (optind < argc) ? argc - optind : 1;
 
-    // Process any remaining command line arguments (input files).
-    do {
+    if (merge_mode) {
+        char *stdin_name = "-";
+        status = merge_hists(NULL, (optind < argc) ? argv + optind : &stdin_name, nfiles, stdout);
+        check_debug(status >= 0, "Stopped after an error.");
 
-        char *filename = NULL;
+        return be_quiet ? status : 0;
+    }
 
-        // Assume STDIN if no additional arguments, else loop through them:
-        if (optind == argc) {
-            filename = "-";
-        }
-        else if (optind < argc) {
-            filename = argv[j];
-        }
-        else if (optind > argc) {
-            break;
-        }
+    if (save_arg) {
+        saved = calloc(nfiles, sizeof(FC_hist *));
+        check_mem(saved);
+    }
 
-        if (count_lines) {
+    // With several files and several jobs, count whole files concurrently
+    // (each one on a single thread), and print their counts in order:
+    if (jobs > 1 && argc - optind > 1) {
+        status = FC_pool_run(argc - optind, jobs, !unordered, count_file_job, argv + optind, stdout);
+        check_debug(status >= 0, "Stopped after an error.");
+        inconsistent_file = status;
+    }
+    else {
+        file_jobs = jobs;
 
-            if (csv_mode) {
-                check(line_count_csv(filename) == 0, "Error counting CSV file: %s", filename);
-            }
-            else {
-                check(line_count(filename) == 0, "Error counting file: %s", filename);
-            }
-            printf("%ld\t%s\n", linecount, filename);
-            linecount = 0;
+        // Open several files (on one thread) ahead of counting them:
+        if (argc - optind > 1 && io_depth > 0) {
+            uring = FC_uring_create(argv + optind, argc - optind, io_depth, buffer_size);
         }
-        else {
-            // The dynamic array that will hold all field counts:
-            DArray *darray = DArray_create(sizeof(FCount), 10);
 
-            // Count the file:
-            if (csv_mode) {
-                check(file_count_csv(filename, darray) == 0, "Error counting CSV file: %s", filename);
+        int j = optind;  // A copy of optind (the number of options at the command-line),
+                         // which is not the same as argc, as that counts ALL
+                         // arguments.  (optind <= argc).
+
+        // Process any remaining command line arguments (input files).
+        do {
+
+            char *filename = NULL;
+
+            // Assume STDIN if no additional arguments, else loop through them:
+            if (optind == argc) {
+                filename = "-";
             }
-            else {
-                check(file_count(filename, darray) == 0, "Error counting file: %s", filename);
+            else if (optind < argc) {
+                filename = argv[j];
             }
-
-            // If we have more than one field count in this file, set the
-            // inconsistent_file flag to 2:
-            if (darray->end > 1) {
-                inconsistent_file = 2;
+            else if (optind > argc) {
+                break;
             }
 
-            if (!be_quiet) {
-                FC_array_sort(darray, FC_cmp);
-                FC_array_print(darray, filename);
+            status = count_file(filename, stdout, saved ? &saved[j - optind] : NULL);
+            check_debug(status >= 0, "Stopped after an error.");
+
+            if (status > inconsistent_file) {
+                inconsistent_file = status;
             }
-            FC_array_destroy(darray);
-        }
 
+            j++;
+
+        } while (j < argc);
+
+        FC_uring_destroy(uring);
+        uring = NULL;
+    }
+
+    // Save the counts of all the files, added up in order:
+    if (save_arg) {
+        check_debug(merge_hists(saved, NULL, nfiles, stdout) >= 0, "Stopped after an error.");
 
-        j++;
+        for (i = 0; i < nfiles; i++) {
+            FC_hist_destroy(saved[i]);
+        }
+        free(saved);
+    }
 
-    } while (j < argc);
+    if (all_fp) {
+        check(fclose(all_fp) == 0, "Error writing file: %s.", all_arg);
+    }
 
-    if (be_quiet) {
+    if (be_quiet || expect) {
         return inconsistent_file;
     }
     else {
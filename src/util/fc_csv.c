@@ -0,0 +1,800 @@
+// -------------------------------------------------------------------------
+// Counting-only CSV parsing.
+//
+// libcsv's csv_parse() copies every byte of a field into its entry buffer
+// and calls back once per field, while fcount only wants to know how many
+// fields each row has.  The parser here walks the same state machine, but
+// keeps nothing besides the state and the counts.
+//
+// The transitions are precomputed into a table, one row per state, by
+// following libcsv's tests for each byte in the order it makes them, so the
+// counts stay exact even for awkward delimiters (a space, a tab, a CR, the
+// quote itself...):
+//
+//  - spaces and tabs before a field are skipped,
+//  - a CR or LF ends the row, unless in a quoted field, but rows with no
+//    fields at all (empty lines, CRLF pairs) are not reported,
+//  - a quote in a quoted field either ends it or (doubled) is literal, and
+//    a quote after trailing spaces there is literal too,
+//  - a row not ended by the input is ended by FC_csv_finish() (csv_fini).
+//
+// The vector kernels (FC_csv_sse2, ...) find the structure of 64 bytes at a
+// time instead, like the first stage of simdjson: bitmasks of the quotes
+// (q), delimiters (d), CRs and LFs (t) and blanks (b) of the chunk, and the
+// mask of the bytes inside quotes, which is the prefix XOR of q (computed
+// with a carry-less multiply by all ones where the CPU has one).  A doubled
+// quote "" just closes and reopens the quotes with nothing in between.  The
+// unquoted delimiters and CR/LFs are then counted with popcount, as in
+// fc_scan.c, with a row only counted if it holds anything but blanks.
+//
+// That agrees with libcsv as long as every quote that opens a field comes
+// right after a delimiter, a CR/LF or a closing quote, and every quote that
+// closes one is followed right away by a delimiter, a CR/LF or a quote.  A
+// chunk that breaks these rules (a quote inside an unquoted field, a blank
+// before or after a quoted field...) is left to the state machine, and the
+// vector kernel takes over again after it.
+//
+// Most CSV files have no quotes in most of their chunks, if at all.  Outside
+// quotes, a chunk with no quote in it needs no prefix XOR and can't break
+// the rules, so the kernels count runs of such chunks as fc_scan.c counts
+// plain delimited text (minding only the blanks), with the state kept in
+// registers, and only go back to following quotes at a chunk with one.
+// -------------------------------------------------------------------------
+#include <assert.h>
+#include <stdint.h>
+#include "util/dbg.h"
+#include "util/fc_hist.h"
+#include "util/fc_csv.h"
+#include "util/fc_engine.h"
+
+#ifdef FC_X86
+#include <immintrin.h>
+#endif
+
+#define is_space(C) ((C) == ' ' || (C) == '\t')
+#define is_term(C) ((C) == '\r' || (C) == '\n')
+
+// The vector rules assume the quote and the delimiter are distinct, and
+// neither is a CR or LF (nor the quote a blank):
+#define csv_rules_hold(D, Q) (!is_term(D) && !is_term(Q) && !is_space(Q) && (Q) != (D))
+
+// The transition from STATE on byte C, as csv_parse() makes it:
+static unsigned char csv_transition(int state, int c, int delim, int quote)
+{
+    switch (state) {
+        case FC_CSV_ROW_NOT_BEGUN:
+        case FC_CSV_FIELD_NOT_BEGUN:
+            if (is_space(c) && c != delim) return state;
+            if (is_term(c)) {
+                // Empty rows aren't reported:
+                return (state == FC_CSV_FIELD_NOT_BEGUN) ? (FC_CSV_ROW_NOT_BEGUN | FC_CSV_FIELD | FC_CSV_ROW) : FC_CSV_ROW_NOT_BEGUN;
+            }
+            if (c == delim) return FC_CSV_FIELD_NOT_BEGUN | FC_CSV_FIELD;
+            if (c == quote) return FC_CSV_QUOTED;
+            return FC_CSV_FIELD_BEGUN;
+
+        case FC_CSV_FIELD_BEGUN:
+            if (c == quote) return FC_CSV_FIELD_BEGUN;
+            if (c == delim) return FC_CSV_FIELD_NOT_BEGUN | FC_CSV_FIELD;
+            if (is_term(c)) return FC_CSV_ROW_NOT_BEGUN | FC_CSV_FIELD | FC_CSV_ROW;
+            return FC_CSV_FIELD_BEGUN;
+
+        case FC_CSV_QUOTED:
+            if (c == quote) return FC_CSV_MIGHT_HAVE_ENDED;
+            return FC_CSV_QUOTED;
+
+        case FC_CSV_MIGHT_HAVE_ENDED:
+        case FC_CSV_MHE_SPACES:
+            if (c == delim) return FC_CSV_FIELD_NOT_BEGUN | FC_CSV_FIELD;
+            if (is_term(c)) return FC_CSV_ROW_NOT_BEGUN | FC_CSV_FIELD | FC_CSV_ROW;
+            if (is_space(c)) return FC_CSV_MHE_SPACES;
+            if (c == quote) {
+                // A doubled quote is literal, and so is one after spaces:
+                return (state == FC_CSV_MHE_SPACES) ? FC_CSV_MIGHT_HAVE_ENDED : FC_CSV_QUOTED;
+            }
+            return FC_CSV_QUOTED;
+    }
+
+    return FC_CSV_ROW_NOT_BEGUN;
+}
+
+void FC_csv_init(FC_csv *c, unsigned char delim, unsigned char quote)
+{
+    int state = 0;
+    int byte = 0;
+
+    assert(c != NULL);
+
+    c->state = FC_CSV_ROW_NOT_BEGUN;
+    c->fields = 0;
+    c->rows = 0;
+    c->delim = delim;
+    c->quote = quote;
+    c->last = '\n';
+
+    c->expect = 0;
+    c->lines = 0;
+    c->line = 1;
+    c->start = 0;
+    c->pos = 0;
+    c->report = NULL;
+    c->data = NULL;
+
+    if (!csv_rules_hold(delim, quote)) {
+        c->kernel = FC_csv_scalar;
+    }
+    else if (delim == ',' && quote == '"') {
+        c->kernel = FC_engine_current()->csv[FC_CSV_COMMA];
+    }
+    else if (delim == '\t' && quote == '"') {
+        c->kernel = FC_engine_current()->csv[FC_CSV_TAB];
+    }
+    else {
+        c->kernel = FC_engine_current()->csv[FC_CSV_ANY];
+    }
+
+    for (state = 0; state < FC_CSV_STATES; state++) {
+        for (byte = 0; byte < 256; byte++) {
+            c->next[state][byte] = csv_transition(state, byte, delim, quote);
+        }
+    }
+}
+
+// The state machine, a byte at a time:
+int FC_csv_scalar(FC_csv *c, const unsigned char *p, size_t len, FC_hist *hist)
+{
+    const unsigned char *end = p + len;
+    int state = c->state;
+    unsigned long fields = c->fields;
+
+    while (p < end) {
+        const unsigned char *next = c->next[state];
+        unsigned char t = 0;
+
+        // Skip the bytes that leave the state as it is (most of them, in or
+        // out of quotes), which needn't wait for one another:
+        while (p < end && next[*p] == state) p++;
+        if (p == end) break;
+
+        t = next[*p++];
+        state = t & FC_CSV_STATE;
+
+        if (t & FC_CSV_FIELD) {
+            fields++;
+
+            if (t & FC_CSV_ROW) {
+                c->rows++;
+                if (hist) {
+                    check(FC_hist_add(hist, fields) == 0, "Error counting record.");
+                }
+                fields = 0;
+            }
+        }
+    }
+
+    c->state = state;
+    c->fields = fields;
+
+    return 0;
+
+error:
+    return -1;
+}
+
+
+// The state of the vector kernels, carried from one chunk to the next:
+struct csv_carry {
+    int valid;              // is this (rather than FC_csv.state) the state?
+    uint64_t inq;           // all ones if the chunk starts inside quotes
+    int open_ok;            // may a quote at the start of the chunk open a field?
+    int closed;             // did the last chunk end with a closing quote?
+    int row_open;           // does the open row hold anything but blanks?
+    int field_open;         // ...and the open field?
+    unsigned long fields;   // unquoted delimiters in the open row
+};
+
+// Take over the state of the state machine, with LAST the byte before the
+// chunk.  Returns 0 for a state the vector rules can't carry on from (blanks
+// after a closing quote):
+static int csv_carry_from(const FC_csv *c, struct csv_carry *k, unsigned char last)
+{
+    k->inq = 0;
+    k->open_ok = 0;
+    k->closed = 0;
+    k->row_open = 1;
+    k->field_open = 1;
+    k->fields = c->fields;
+
+    switch (c->state) {
+        case FC_CSV_ROW_NOT_BEGUN:
+            k->row_open = 0;
+            k->field_open = 0;
+            k->open_ok = is_term(last);
+            break;
+        case FC_CSV_FIELD_NOT_BEGUN:
+            k->field_open = 0;
+            k->open_ok = (last == c->delim);
+            break;
+        case FC_CSV_FIELD_BEGUN:
+            break;
+        case FC_CSV_QUOTED:
+            k->inq = ~0ULL;
+            break;
+        case FC_CSV_MIGHT_HAVE_ENDED:
+            k->closed = 1;
+            k->open_ok = 1;
+            break;
+        default:
+            return (k->valid = 0);
+    }
+
+    return (k->valid = 1);
+}
+
+// Hand the state back to the state machine:
+static void csv_carry_to(FC_csv *c, struct csv_carry *k)
+{
+    if (k->inq) c->state = FC_CSV_QUOTED;
+    else if (k->closed) c->state = FC_CSV_MIGHT_HAVE_ENDED;
+    else if (!k->row_open) c->state = FC_CSV_ROW_NOT_BEGUN;
+    else if (!k->field_open) c->state = FC_CSV_FIELD_NOT_BEGUN;
+    else c->state = FC_CSV_FIELD_BEGUN;
+
+    c->fields = k->fields;
+    k->valid = 0;
+}
+
+// Count a chunk from its masks, and the prefix XOR (px) of its quotes.
+// Returns 1, with nothing counted, if the chunk breaks the vector rules:
+static inline __attribute__((always_inline))
+int csv_masks(FC_csv *c, struct csv_carry *k, uint64_t q, uint64_t px, uint64_t d, uint64_t t, uint64_t b, FC_hist *hist)
+{
+    uint64_t inq = px ^ k->inq;         // inside quotes (opening quotes included)
+    uint64_t open = q & inq;
+    uint64_t close = q & ~inq;
+    uint64_t du = d & ~inq;
+    uint64_t tu = t & ~inq;
+    uint64_t open_ok = ((du | tu | close) << 1) | (uint64_t)k->open_ok;
+    uint64_t close_ok = d | t | q;
+    uint64_t s = ~(b | t);              // bytes that make a row non-empty
+    uint64_t sf = s & ~d;               // ...and a field
+    uint64_t sep = du | tu;
+
+    if (open & ~open_ok) return 1;
+    if (close & ~(close_ok >> 1) & ~(1ULL << 63)) return 1;
+    if (k->closed && !(close_ok & 1)) return 1;
+
+    k->open_ok = (int)(((du | tu | close) >> 63) & 1);
+    k->closed = (int)(close >> 63);
+    k->inq = (uint64_t)((int64_t)inq >> 63);
+
+    if (sep) {
+        int last = 63 - __builtin_clzll(sep);
+        k->field_open = (last < 63) && (sf >> (last + 1)) != 0;
+    }
+    else if (sf) {
+        k->field_open = 1;
+    }
+
+    while (tu) {
+        uint64_t upto = tu ^ (tu - 1);  // bits up to and including the CR/LF
+
+        k->fields += __builtin_popcountll(du & upto);
+
+        // Empty rows aren't reported:
+        if (k->row_open || (s & upto)) {
+            c->rows++;
+            if (hist) {
+                check(FC_hist_add(hist, k->fields + 1) == 0, "Error counting record.");
+            }
+        }
+
+        k->fields = 0;
+        k->row_open = 0;
+
+        du &= ~upto;
+        s &= ~upto;
+        tu &= tu - 1;
+    }
+
+    k->fields += __builtin_popcountll(du);
+    if (s) k->row_open = 1;
+
+    return 0;
+
+error:
+    return -1;
+}
+
+// The state of a run of chunks with no quotes in them (nor open before
+// them), kept apart from the carry so that it stays in registers:
+struct csv_plain {
+    unsigned long fields;   // delimiters in the open row
+    int row_open;           // does the open row hold anything but blanks?
+    int field_open;         // ...and the open field?
+    int open_ok;            // did the last chunk end with a delimiter or CR/LF?
+};
+
+// Count a chunk with no quotes from its masks, as fc_scan.c counts plain
+// delimited text, but for the blanks: a row is only left unreported if the
+// first byte in it that isn't a blank is the CR/LF that ends it.  Adding the
+// blanks to the bit where each row starts carries it past the blanks there,
+// onto that byte, which finds all such rows at once (and a carry out of the
+// chunk leaves the last row empty so far).  The open field is followed the
+// same way, from the delimiters too:
+static inline __attribute__((always_inline))
+int csv_plain_masks(FC_csv *c, struct csv_plain *r, uint64_t d, uint64_t t, uint64_t b, FC_hist *hist)
+{
+    uint64_t sep = d | t;
+    uint64_t starts = (t << 1) | (uint64_t)!r->row_open;
+    uint64_t fstarts = (sep << 1) | (uint64_t)!r->field_open;
+    uint64_t lands = 0, flands = 0;
+    int empty = __builtin_add_overflow(starts & b, b, &lands);
+    int fempty = __builtin_add_overflow(fstarts & b, b, &flands);
+    uint64_t n = t & ~((lands & ~b) | (starts & ~b));   // the CR/LFs ending rows to report
+
+    r->row_open = !empty && !(t >> 63);
+    r->field_open = !fempty && !(sep >> 63);
+    r->open_ok = (int)(sep >> 63);
+
+    while (n) {
+        uint64_t upto = n ^ (n - 1);    // bits up to and including the CR/LF
+
+        r->fields += __builtin_popcountll(d & upto);
+        c->rows++;
+        if (hist) {
+            check(FC_hist_add(hist, r->fields + 1) == 0, "Error counting record.");
+        }
+
+        r->fields = 0;
+        d &= ~upto;
+        n &= n - 1;
+    }
+
+    r->fields += __builtin_popcountll(d);
+
+    return 0;
+
+error:
+    return -1;
+}
+
+// Start a quote-free run from the carry, if it's outside quotes:
+static inline __attribute__((always_inline))
+int csv_plain_from(const struct csv_carry *k, struct csv_plain *r)
+{
+    r->fields = k->fields;
+    r->row_open = k->row_open;
+    r->field_open = k->field_open;
+    r->open_ok = k->open_ok;
+
+    return k->valid && !k->inq && !k->closed;
+}
+
+// ...and hand it back at the end of the run:
+static inline __attribute__((always_inline))
+void csv_plain_to(struct csv_carry *k, const struct csv_plain *r)
+{
+    k->open_ok = r->open_ok;
+    k->row_open = r->row_open;
+    k->field_open = r->field_open;
+    k->fields = r->fields;
+}
+
+// Prefix XOR: bit i of the result is the parity of bits 0..i of X:
+static inline __attribute__((always_inline))
+uint64_t prefix_xor(uint64_t x)
+{
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+
+    return x;
+}
+
+// Count a 64-byte chunk with the vector rules if the carry allows and the
+// chunk keeps to them, or else with the state machine:
+static inline __attribute__((always_inline))
+int csv_chunk(FC_csv *c, struct csv_carry *k, const unsigned char *p, uint64_t q, uint64_t px, uint64_t d, uint64_t t, uint64_t b, FC_hist *hist)
+{
+    int rc = 0;
+
+    if (k->valid) {
+        rc = csv_masks(c, k, q, px, d, t, b, hist);
+        if (rc <= 0) return rc;
+        csv_carry_to(c, k);
+    }
+
+    check(FC_csv_scalar(c, p, 64, hist) == 0, "Error counting block.");
+    csv_carry_from(c, k, p[63]);
+
+    return 0;
+
+error:
+    return -1;
+}
+
+// Count the tail of a block (less than a chunk) with the state machine:
+static inline __attribute__((always_inline))
+int csv_tail(FC_csv *c, struct csv_carry *k, const unsigned char *p, size_t len, FC_hist *hist)
+{
+    if (k->valid) csv_carry_to(c, k);
+
+    return FC_csv_scalar(c, p, len, hist);
+}
+
+#ifdef FC_X86
+
+// The same, with a carry-less multiply by all ones:
+static inline __attribute__((always_inline, target("sse2,pclmul")))
+uint64_t prefix_xor_clmul(uint64_t x)
+{
+    __m128i v = _mm_set_epi64x(0, (long long)x);
+    uint64_t r = 0;
+
+    _mm_storel_epi64((__m128i *)&r, _mm_clmulepi64_si128(v, _mm_set1_epi8((char)0xff), 0));
+
+    return r;
+}
+
+static inline __attribute__((always_inline, target("sse2")))
+uint64_t movemask_sse(__m128i v0, __m128i v1, __m128i v2, __m128i v3)
+{
+    return (uint64_t)(uint16_t)_mm_movemask_epi8(v0)
+         | (uint64_t)(uint16_t)_mm_movemask_epi8(v1) << 16
+         | (uint64_t)(uint16_t)_mm_movemask_epi8(v2) << 32
+         | (uint64_t)(uint16_t)_mm_movemask_epi8(v3) << 48;
+}
+
+static inline __attribute__((always_inline))
+int csv_sse(FC_csv *c, const unsigned char *p, size_t len, FC_hist *hist, unsigned char delim, unsigned char quote)
+{
+    const __m128i vq = _mm_set1_epi8((char)quote);
+    const __m128i vd = _mm_set1_epi8((char)delim);
+    const __m128i vr = _mm_set1_epi8('\r');
+    const __m128i vn = _mm_set1_epi8('\n');
+    const __m128i vs = _mm_set1_epi8(' ');
+    const __m128i vt = _mm_set1_epi8('\t');
+    struct csv_carry k;
+    struct csv_plain r;
+    size_t i = 0;
+
+    csv_carry_from(c, &k, c->last);
+
+#define LOAD_SSE() (v0 = _mm_loadu_si128((const __m128i *)(p + i)), \
+                    v1 = _mm_loadu_si128((const __m128i *)(p + i + 16)), \
+                    v2 = _mm_loadu_si128((const __m128i *)(p + i + 32)), \
+                    v3 = _mm_loadu_si128((const __m128i *)(p + i + 48)))
+#define CMP_SSE(V) movemask_sse(_mm_cmpeq_epi8(v0, (V)), _mm_cmpeq_epi8(v1, (V)), \
+                                _mm_cmpeq_epi8(v2, (V)), _mm_cmpeq_epi8(v3, (V)))
+    while (i + 64 <= len) {
+        __m128i v0, v1, v2, v3;
+        uint64_t q = 0, d = 0, t = 0, b = 0;
+
+        if (csv_plain_from(&k, &r)) {
+            for (; i + 64 <= len; i += 64) {
+                LOAD_SSE();
+                if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v0, vq), _mm_cmpeq_epi8(v1, vq)),
+                                                   _mm_or_si128(_mm_cmpeq_epi8(v2, vq), _mm_cmpeq_epi8(v3, vq))))) break;
+
+                d = CMP_SSE(vd);
+                t = CMP_SSE(vr) | CMP_SSE(vn);
+                b = CMP_SSE(vs) | CMP_SSE(vt);
+                if (is_space(delim)) b &= ~d;
+
+                check(csv_plain_masks(c, &r, d, t, b, hist) == 0, "Error counting block.");
+            }
+            csv_plain_to(&k, &r);
+            if (i + 64 > len) break;
+        }
+
+        LOAD_SSE();
+        q = CMP_SSE(vq);
+        d = CMP_SSE(vd);
+        t = CMP_SSE(vr) | CMP_SSE(vn);
+        b = CMP_SSE(vs) | CMP_SSE(vt);
+        if (is_space(delim)) b &= ~d;
+
+        check(csv_chunk(c, &k, p + i, q, prefix_xor(q), d, t, b, hist) == 0, "Error counting block.");
+        i += 64;
+    }
+#undef CMP_SSE
+#undef LOAD_SSE
+
+    return csv_tail(c, &k, p + i, len - i, hist);
+
+error:
+    return -1;
+}
+
+static inline __attribute__((always_inline, target("avx2,popcnt,pclmul")))
+int csv_avx2(FC_csv *c, const unsigned char *p, size_t len, FC_hist *hist, unsigned char delim, unsigned char quote)
+{
+    const __m256i vq = _mm256_set1_epi8((char)quote);
+    const __m256i vd = _mm256_set1_epi8((char)delim);
+    const __m256i vr = _mm256_set1_epi8('\r');
+    const __m256i vn = _mm256_set1_epi8('\n');
+    const __m256i vs = _mm256_set1_epi8(' ');
+    const __m256i vt = _mm256_set1_epi8('\t');
+    struct csv_carry k;
+    struct csv_plain r;
+    size_t i = 0;
+
+    csv_carry_from(c, &k, c->last);
+
+#define CMP_AVX2(V) ((uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, (V))) \
+                   | (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, (V))) << 32)
+    while (i + 64 <= len) {
+        __m256i lo, hi;
+        uint64_t q = 0, d = 0, t = 0, b = 0;
+
+        if (csv_plain_from(&k, &r)) {
+            for (; i + 64 <= len; i += 64) {
+                lo = _mm256_loadu_si256((const __m256i *)(p + i));
+                hi = _mm256_loadu_si256((const __m256i *)(p + i + 32));
+                if (CMP_AVX2(vq)) break;
+
+                d = CMP_AVX2(vd);
+                t = CMP_AVX2(vr) | CMP_AVX2(vn);
+                b = CMP_AVX2(vs) | CMP_AVX2(vt);
+                if (is_space(delim)) b &= ~d;
+
+                check(csv_plain_masks(c, &r, d, t, b, hist) == 0, "Error counting block.");
+            }
+            csv_plain_to(&k, &r);
+            if (i + 64 > len) break;
+        }
+
+        lo = _mm256_loadu_si256((const __m256i *)(p + i));
+        hi = _mm256_loadu_si256((const __m256i *)(p + i + 32));
+        q = CMP_AVX2(vq);
+        d = CMP_AVX2(vd);
+        t = CMP_AVX2(vr) | CMP_AVX2(vn);
+        b = CMP_AVX2(vs) | CMP_AVX2(vt);
+        if (is_space(delim)) b &= ~d;
+
+        check(csv_chunk(c, &k, p + i, q, prefix_xor_clmul(q), d, t, b, hist) == 0, "Error counting block.");
+        i += 64;
+    }
+#undef CMP_AVX2
+
+    return csv_tail(c, &k, p + i, len - i, hist);
+
+error:
+    return -1;
+}
+
+static inline __attribute__((always_inline, target("avx512f,avx512bw,popcnt,pclmul")))
+int csv_avx512(FC_csv *c, const unsigned char *p, size_t len, FC_hist *hist, unsigned char delim, unsigned char quote)
+{
+    const __m512i vq = _mm512_set1_epi8((char)quote);
+    const __m512i vd = _mm512_set1_epi8((char)delim);
+    const __m512i vr = _mm512_set1_epi8('\r');
+    const __m512i vn = _mm512_set1_epi8('\n');
+    const __m512i vs = _mm512_set1_epi8(' ');
+    const __m512i vt = _mm512_set1_epi8('\t');
+    struct csv_carry k;
+    struct csv_plain r;
+    size_t i = 0;
+
+    csv_carry_from(c, &k, c->last);
+
+    while (i + 64 <= len) {
+        __m512i a;
+        uint64_t q = 0, d = 0, t = 0, b = 0;
+
+        if (csv_plain_from(&k, &r)) {
+            for (; i + 64 <= len; i += 64) {
+                a = _mm512_loadu_si512((const void *)(p + i));
+                if (_mm512_cmpeq_epi8_mask(a, vq)) break;
+
+                d = _mm512_cmpeq_epi8_mask(a, vd);
+                t = _mm512_cmpeq_epi8_mask(a, vr) | _mm512_cmpeq_epi8_mask(a, vn);
+                b = _mm512_cmpeq_epi8_mask(a, vs) | _mm512_cmpeq_epi8_mask(a, vt);
+                if (is_space(delim)) b &= ~d;
+
+                check(csv_plain_masks(c, &r, d, t, b, hist) == 0, "Error counting block.");
+            }
+            csv_plain_to(&k, &r);
+            if (i + 64 > len) break;
+        }
+
+        a = _mm512_loadu_si512((const void *)(p + i));
+        q = _mm512_cmpeq_epi8_mask(a, vq);
+        d = _mm512_cmpeq_epi8_mask(a, vd);
+        t = _mm512_cmpeq_epi8_mask(a, vr) | _mm512_cmpeq_epi8_mask(a, vn);
+        b = _mm512_cmpeq_epi8_mask(a, vs) | _mm512_cmpeq_epi8_mask(a, vt);
+        if (is_space(delim)) b &= ~d;
+
+        check(csv_chunk(c, &k, p + i, q, prefix_xor_clmul(q), d, t, b, hist) == 0, "Error counting block.");
+        i += 64;
+    }
+
+    return csv_tail(c, &k, p + i, len - i, hist);
+
+error:
+    return -1;
+}
+
+// Instantiate the kernel NAME from BODY for any delimiter and quote, and
+// for the common pairs as constants, which the compiler folds into the
+// vectors (and drops the blank masking a comma doesn't need):
+#define CSV_KERNELS(NAME, TARGET, BODY) \
+    __attribute__((target(TARGET))) \
+    int NAME(FC_csv *c, const unsigned char *p, size_t len, FC_hist *hist) \
+    { \
+        return BODY(c, p, len, hist, c->delim, c->quote); \
+    } \
+    __attribute__((target(TARGET))) \
+    int NAME##_comma(FC_csv *c, const unsigned char *p, size_t len, FC_hist *hist) \
+    { \
+        return BODY(c, p, len, hist, ',', '"'); \
+    } \
+    __attribute__((target(TARGET))) \
+    int NAME##_tab(FC_csv *c, const unsigned char *p, size_t len, FC_hist *hist) \
+    { \
+        return BODY(c, p, len, hist, '\t', '"'); \
+    }
+
+CSV_KERNELS(FC_csv_sse2, "sse2", csv_sse)
+CSV_KERNELS(FC_csv_sse42, "sse4.2,popcnt", csv_sse)
+CSV_KERNELS(FC_csv_avx2, "avx2,popcnt,pclmul", csv_avx2)
+CSV_KERNELS(FC_csv_avx512, "avx512f,avx512bw,popcnt,pclmul", csv_avx512)
+
+#endif
+
+// Count the fields and rows in a block of input (adding the field count of
+// every row to HIST, unless it's NULL):
+int FC_csv_block(FC_csv *c, const char *buf, size_t len, FC_hist *hist)
+{
+    assert(c != NULL);
+
+    if (len == 0) return 0;
+
+    check(c->kernel(c, (const unsigned char *)buf, len, hist) == 0, "Error counting block.");
+    c->last = buf[len - 1];
+
+    return 0;
+
+error:
+    return -1;
+}
+
+// Count the 64-byte chunk at P from its masks, found by the caller: those
+// of its quotes (q), delimiters (d), CRs and LFs (t) and spaces and tabs
+// (b).  fc_sniff.c classifies every byte once for many delimiters, and
+// counts each of them as CSV this way:
+int FC_csv_chunk(FC_csv *c, const unsigned char *p, uint64_t q, uint64_t d, uint64_t t, uint64_t b, FC_hist *hist)
+{
+    struct csv_carry k;
+    struct csv_plain r;
+
+    assert(c != NULL);
+
+    if (!csv_rules_hold(c->delim, c->quote)) {
+        return FC_csv_block(c, (const char *)p, 64, hist);
+    }
+
+    if (is_space(c->delim)) b &= ~d;
+
+    csv_carry_from(c, &k, c->last);
+
+    if (q == 0 && csv_plain_from(&k, &r)) {
+        check(csv_plain_masks(c, &r, d, t, b, hist) == 0, "Error counting block.");
+        csv_plain_to(&k, &r);
+    }
+    else {
+        check(csv_chunk(c, &k, p, q, prefix_xor(q), d, t, b, hist) == 0, "Error counting block.");
+    }
+
+    if (k.valid) csv_carry_to(c, &k);
+    c->last = p[63];
+
+    return 0;
+
+error:
+    return -1;
+}
+
+// End the last row, if the input didn't (like csv_fini):
+int FC_csv_finish(FC_csv *c, FC_hist *hist)
+{
+    assert(c != NULL);
+
+    if (c->state != FC_CSV_ROW_NOT_BEGUN) {
+        c->rows++;
+        if (hist) {
+            check(FC_hist_add(hist, c->fields + 1) == 0, "Error counting record.");
+        }
+    }
+
+    c->state = FC_CSV_ROW_NOT_BEGUN;
+    c->fields = 0;
+
+    return 0;
+
+error:
+    return -1;
+}
+
+// Start a validating scan, calling REPORT for every row that doesn't have
+// EXPECT fields:
+void FC_csv_expect_init(FC_csv *c, unsigned char delim, unsigned char quote, unsigned long expect, FC_scan_report report, void *data)
+{
+    FC_csv_init(c, delim, quote);
+
+    c->expect = expect;
+    c->report = report;
+    c->data = data;
+}
+
+// Check the rows in a block of input with the state machine, a byte at a
+// time (the lines and offsets of the rows aren't kept by the vector
+// kernels), returning 0, or the nonzero value of the report that stopped
+// the scan:
+int FC_csv_expect_block(FC_csv *c, const char *buf, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)buf;
+    int state = c->state;
+    unsigned long fields = c->fields;
+    size_t i = 0;
+    int rc = 0;
+
+    assert(c != NULL && c->report != NULL);
+
+    for (i = 0; i < len && rc == 0; i++) {
+        unsigned char t = c->next[state][p[i]];
+
+        state = t & FC_CSV_STATE;
+
+        if (t & FC_CSV_FIELD) {
+            fields++;
+
+            if (t & FC_CSV_ROW) {
+                c->rows++;
+                if (fields != c->expect) {
+                    rc = c->report(c->data, c->line, c->start, fields);
+                }
+                fields = 0;
+            }
+        }
+
+        if (p[i] == '\n') c->lines++;
+
+        // The next row starts after the CR or LF that ended this one (or
+        // the empty line before it, which isn't a row):
+        if (state == FC_CSV_ROW_NOT_BEGUN && is_term(p[i])) {
+            c->line = c->lines + 1;
+            c->start = c->pos + i + 1;
+        }
+    }
+
+    c->state = state;
+    c->fields = fields;
+    c->pos += i;
+
+    return rc;
+}
+
+// Check the last row, if the input didn't end it:
+int FC_csv_expect_finish(FC_csv *c)
+{
+    int rc = 0;
+
+    assert(c != NULL && c->report != NULL);
+
+    if (c->state != FC_CSV_ROW_NOT_BEGUN) {
+        c->rows++;
+        if (c->fields + 1 != c->expect) {
+            rc = c->report(c->data, c->line, c->start, c->fields + 1);
+        }
+    }
+
+    c->state = FC_CSV_ROW_NOT_BEGUN;
+    c->fields = 0;
+
+    return rc;
+}
@@ -0,0 +1,74 @@
+#ifndef _FC_csv_h
+#define _FC_csv_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <util/fc_hist.h>
+#include <util/fc_scan.h>
+
+// The states of the CSV counter, which are those of libcsv's parser (with
+// its quote and trailing-space flags folded in where they matter):
+#define FC_CSV_ROW_NOT_BEGUN    0   // no field yet in this row
+#define FC_CSV_FIELD_NOT_BEGUN  1   // after a delimiter
+#define FC_CSV_FIELD_BEGUN      2   // in an unquoted field
+#define FC_CSV_QUOTED           3   // in a quoted field
+#define FC_CSV_MIGHT_HAVE_ENDED 4   // after a quote in a quoted field
+#define FC_CSV_MHE_SPACES       5   // ...followed by spaces or tabs
+#define FC_CSV_STATES           6
+
+// Actions on a transition, besides the next state:
+#define FC_CSV_STATE  0x07
+#define FC_CSV_FIELD  0x08          // a field ends
+#define FC_CSV_ROW    0x10          // ...and so does the row
+
+// The variants of every CSV kernel, specialized for the common delimiter
+// and quote pairs (see FC_engine):
+#define FC_CSV_ANY      0   // any delimiter and quote
+#define FC_CSV_COMMA    1   // a comma and a double quote
+#define FC_CSV_TAB      2   // a tab and a double quote
+#define FC_CSV_VARIANTS 3
+
+// A counting-only CSV parser: it follows the quoting of the input, and
+// counts fields and rows exactly as libcsv (with no options) reports them,
+// but never copies a field:
+typedef struct FC_csv {
+    int state;
+    unsigned long fields;           // fields ended so far in the open row
+    unsigned long long rows;        // rows ended so far
+    unsigned char delim;
+    unsigned char quote;
+    unsigned char last;             // the last byte counted
+    int (*kernel) (struct FC_csv *c, const unsigned char *p, size_t len, FC_hist *hist);
+    unsigned char next[FC_CSV_STATES][256];
+
+    // Validating scans only (see FC_scan).  A row is reported at the line
+    // (from 1) and offset (from 0) it starts at, so a quoted newline in it
+    // makes it span several lines:
+    unsigned long expect;
+    unsigned long long lines;       // newlines seen so far
+    unsigned long long line;        // the line the open row starts on
+    unsigned long long start;       // ...and its offset
+    unsigned long long pos;         // offset of the block
+    FC_scan_report report;
+    void *data;
+} FC_csv;
+
+typedef int (*FC_csv_kernel) (FC_csv *c, const unsigned char *p, size_t len, FC_hist *hist);
+
+void FC_csv_init(FC_csv *c, unsigned char delim, unsigned char quote);
+
+int FC_csv_block(FC_csv *c, const char *buf, size_t len, FC_hist *hist);
+
+int FC_csv_chunk(FC_csv *c, const unsigned char *p, uint64_t q, uint64_t d, uint64_t t, uint64_t b, FC_hist *hist);
+
+int FC_csv_finish(FC_csv *c, FC_hist *hist);
+
+void FC_csv_expect_init(FC_csv *c, unsigned char delim, unsigned char quote, unsigned long expect, FC_scan_report report, void *data);
+
+int FC_csv_expect_block(FC_csv *c, const char *buf, size_t len);
+
+int FC_csv_expect_finish(FC_csv *c);
+
+int FC_csv_scalar(FC_csv *c, const unsigned char *p, size_t len, FC_hist *hist);
+
+#endif
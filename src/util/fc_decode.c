@@ -0,0 +1,595 @@
+// -------------------------------------------------------------------------
+// Streaming decompression of gzip, bzip2, xz and zstd input.
+//
+// A compressed input is recognized by its magic bytes, and decoded a piece
+// at a time straight into the blocks the counting kernels scan, so that it
+// needn't be piped through zcat (and the like) first.  Each format is only
+// built in if configure found its library; a file in any other format is
+// counted as it is, as it always was.
+//
+// Files of several members (or streams, or frames) one after another, as
+// 'cat a.gz b.gz' makes them, are decoded whole, as zcat decodes them.
+//
+// Some files record where each member ends, and how long it decodes to:
+// BGZF (gzip members with their length in a "BC" extra field, as bgzip
+// writes them), and zstd frames with their content size, or with a seek
+// table (the zstd seekable format).  These can be cut into chunks of whole
+// members without decoding them (see FC_decode_chunks), and the chunks
+// decoded on several threads at once.  Any other deflate stream can't be
+// cut short of decoding it.
+//
+// gzip and bzip2 decode in a fixed, small amount of memory, but xz and zstd
+// take as much as the file was compressed with (the dictionary, or the
+// window), which may be very large.  FC_decode_limit() bounds it for every
+// decoder created after it, and a file that needs more is an error.
+// -------------------------------------------------------------------------
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util/dbg.h"
+#include "util/fc_decode.h"
+
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+#define FC_GZIP 1
+#include <zlib.h>
+#endif
+
+#if defined(HAVE_BZLIB_H) && defined(HAVE_LIBBZ2)
+#define FC_BZIP2 1
+#include <bzlib.h>
+#endif
+
+#if defined(HAVE_LZMA_H) && defined(HAVE_LIBLZMA)
+#define FC_XZ 1
+#include <lzma.h>
+#endif
+
+#if defined(HAVE_ZSTD_H) && defined(HAVE_LIBZSTD)
+#define FC_ZSTD 1
+#include <zstd.h>
+#include <zstd_errors.h>
+#endif
+
+// The most memory a decoder may take (0 is no limit):
+static size_t decode_limit = 0;
+
+struct FC_decoder {
+    int format;
+    int ended;          // is it at the end of a member (not partway through)?
+    union {
+#ifdef FC_GZIP
+        z_stream z;
+#endif
+#ifdef FC_BZIP2
+        bz_stream bz;
+#endif
+#ifdef FC_XZ
+        lzma_stream xz;
+#endif
+#ifdef FC_ZSTD
+        ZSTD_DStream *zstd;
+#endif
+        int unused;
+    } s;
+};
+
+static const struct {
+    const char *name;
+    const char *magic;
+    size_t len;
+    int built;
+} formats[] = {
+    { "none",  "", 0, 1 },
+#ifdef FC_GZIP
+    { "gzip",  "\x1f\x8b", 2, 1 },
+#else
+    { "gzip",  "\x1f\x8b", 2, 0 },
+#endif
+#ifdef FC_BZIP2
+    { "bzip2", "BZh", 3, 1 },
+#else
+    { "bzip2", "BZh", 3, 0 },
+#endif
+#ifdef FC_XZ
+    { "xz",    "\xfd" "7zXZ\0", 6, 1 },
+#else
+    { "xz",    "\xfd" "7zXZ\0", 6, 0 },
+#endif
+#ifdef FC_ZSTD
+    { "zstd",  "\x28\xb5\x2f\xfd", 4, 1 },
+#else
+    { "zstd",  "\x28\xb5\x2f\xfd", 4, 0 },
+#endif
+};
+
+// Does a bzip2 stream start at P, past its "BZh"?  A text file may well
+// start with those three letters, so the block size digit and the magic
+// number of the first block (or of the end of an empty stream) must follow:
+static int bzip2_follows(const char *p, size_t len)
+{
+    return len >= 10 && p[3] >= '1' && p[3] <= '9' &&
+        (memcmp(p + 4, "\x31\x41\x59\x26\x53\x59", 6) == 0 ||
+         memcmp(p + 4, "\x17\x72\x45\x38\x50\x90", 6) == 0);
+}
+
+// Keep every decoder created from now on within BYTES of memory (or none,
+// if 0):
+void FC_decode_limit(size_t bytes)
+{
+    decode_limit = bytes;
+}
+
+#ifdef FC_ZSTD
+// The largest window (its log) that a zstd decoder can keep within the
+// limit, along with its buffers of up to 3 blocks:
+static int zstd_window_log(void)
+{
+    ZSTD_bounds bounds = ZSTD_dParam_getBounds(ZSTD_d_windowLogMax);
+    int wlog = bounds.lowerBound;
+
+    while (wlog < bounds.upperBound && ((size_t)1 << (wlog + 1)) + 3 * ZSTD_BLOCKSIZE_MAX <= decode_limit) {
+        wlog++;
+    }
+
+    return wlog;
+}
+#endif
+
+// The format of the input starting with the LEN bytes at P.  A format that
+// wasn't built in is FC_DECODE_NONE:
+int FC_decode_format(const char *p, size_t len)
+{
+    int f = 0;
+
+    assert(p != NULL || len == 0);
+
+    for (f = FC_DECODE_GZIP; f <= FC_DECODE_ZSTD; f++) {
+        if (len < formats[f].len || memcmp(p, formats[f].magic, formats[f].len) != 0) continue;
+        if (f == FC_DECODE_BZIP2 && !bzip2_follows(p, len)) continue;
+
+        if (!formats[f].built) {
+            debug("%s input, but not built with %s: counting it as it is", formats[f].name, formats[f].name);
+            return FC_DECODE_NONE;
+        }
+
+        return f;
+    }
+
+    return FC_DECODE_NONE;
+}
+
+const char *FC_decode_name(int format)
+{
+    assert(format >= FC_DECODE_NONE && format <= FC_DECODE_ZSTD);
+
+    return formats[format].name;
+}
+
+FC_decoder *FC_decoder_create(int format)
+{
+    FC_decoder *d = calloc(1, sizeof(FC_decoder));
+    int rc = 0;
+
+    check_mem(d);
+    d->format = format;
+    (void)rc;
+
+    switch (format) {
+#ifdef FC_GZIP
+        case FC_DECODE_GZIP:
+            rc = inflateInit2(&d->s.z, 15 + 16);
+            check(rc == Z_OK, "Error starting gzip decompression.");
+            break;
+#endif
+#ifdef FC_BZIP2
+        case FC_DECODE_BZIP2:
+            rc = BZ2_bzDecompressInit(&d->s.bz, 0, 0);
+            check(rc == BZ_OK, "Error starting bzip2 decompression.");
+            break;
+#endif
+#ifdef FC_XZ
+        case FC_DECODE_XZ:
+            d->s.xz = (lzma_stream)LZMA_STREAM_INIT;
+            rc = lzma_stream_decoder(&d->s.xz, decode_limit ? decode_limit : UINT64_MAX, LZMA_CONCATENATED);
+            check(rc == LZMA_OK, "Error starting xz decompression.");
+            break;
+#endif
+#ifdef FC_ZSTD
+        case FC_DECODE_ZSTD:
+            d->s.zstd = ZSTD_createDStream();
+            check_mem(d->s.zstd);
+            if (ZSTD_isError(ZSTD_initDStream(d->s.zstd)) ||
+                (decode_limit && ZSTD_isError(ZSTD_DCtx_setParameter(d->s.zstd, ZSTD_d_windowLogMax, zstd_window_log())))) {
+                ZSTD_freeDStream(d->s.zstd);
+                sentinel("Error starting zstd decompression.");
+            }
+            break;
+#endif
+        default:
+            sentinel("No decompression for format %d.", format);
+    }
+
+    return d;
+
+error:
+    free(d);
+    return NULL;
+}
+
+#ifdef FC_GZIP
+static ssize_t gzip_run(FC_decoder *d, const char **src, size_t *srclen, char *out, size_t outlen)
+{
+    z_stream *z = &d->s.z;
+    int rc = Z_OK;
+
+    z->next_in = (Bytef *)*src;
+    z->avail_in = *srclen;
+    z->next_out = (Bytef *)out;
+    z->avail_out = outlen;
+
+    while (z->avail_out > 0) {
+        // Another member follows the last one:
+        if (d->ended) {
+            if (z->avail_in == 0) break;
+            inflateReset(z);
+            d->ended = 0;
+        }
+
+        rc = inflate(z, Z_NO_FLUSH);
+        if (rc == Z_STREAM_END) d->ended = 1;
+        else if (rc == Z_BUF_ERROR) break;
+        else if (rc != Z_OK) return -1;
+    }
+
+    *src = (const char *)z->next_in;
+    *srclen = z->avail_in;
+
+    return outlen - z->avail_out;
+}
+#endif
+
+#ifdef FC_BZIP2
+static ssize_t bzip2_run(FC_decoder *d, const char **src, size_t *srclen, char *out, size_t outlen)
+{
+    bz_stream *bz = &d->s.bz;
+    unsigned int in = 0, left = 0;
+    int rc = BZ_OK;
+
+    bz->next_in = (char *)*src;
+    bz->avail_in = *srclen;
+    bz->next_out = out;
+    bz->avail_out = outlen;
+
+    while (bz->avail_out > 0) {
+        // Another stream follows the last one:
+        if (d->ended) {
+            if (bz->avail_in == 0) break;
+            BZ2_bzDecompressEnd(bz);
+            if (BZ2_bzDecompressInit(bz, 0, 0) != BZ_OK) return -1;
+            d->ended = 0;
+        }
+
+        in = bz->avail_in;
+        left = bz->avail_out;
+        rc = BZ2_bzDecompress(bz);
+        if (rc == BZ_STREAM_END) d->ended = 1;
+        else if (rc != BZ_OK) return -1;
+        else if (bz->avail_in == in && bz->avail_out == left) break;
+    }
+
+    *src = bz->next_in;
+    *srclen = bz->avail_in;
+
+    return outlen - bz->avail_out;
+}
+#endif
+
+#ifdef FC_XZ
+// With LZMA_CONCATENATED, the end of the last stream is only known once
+// told there's no more input (FINISH):
+static ssize_t xz_run(FC_decoder *d, const char **src, size_t *srclen, char *out, size_t outlen, int finish)
+{
+    lzma_stream *xz = &d->s.xz;
+    lzma_ret rc = LZMA_OK;
+
+    xz->next_in = (const uint8_t *)*src;
+    xz->avail_in = *srclen;
+    xz->next_out = (uint8_t *)out;
+    xz->avail_out = outlen;
+
+    while (xz->avail_out > 0 && !d->ended) {
+        rc = lzma_code(xz, finish ? LZMA_FINISH : LZMA_RUN);
+        if (rc == LZMA_STREAM_END) d->ended = 1;
+        else if (rc == LZMA_BUF_ERROR) break;
+        else if (rc == LZMA_MEMLIMIT_ERROR) {
+            log_err("ERROR: the xz input needs %llu KiB to decode, more than the %zu KiB allowed (see --max-memory)",
+                    (unsigned long long)(lzma_memusage(xz) + 1023) >> 10, decode_limit >> 10);
+            return -1;
+        }
+        else if (rc != LZMA_OK) return -1;
+        else if (xz->avail_in == 0 && !finish) break;
+    }
+
+    *src = (const char *)xz->next_in;
+    *srclen = xz->avail_in;
+
+    return outlen - xz->avail_out;
+}
+#endif
+
+#ifdef FC_ZSTD
+static ssize_t zstd_run(FC_decoder *d, const char **src, size_t *srclen, char *out, size_t outlen)
+{
+    ZSTD_inBuffer in = { *src, *srclen, 0 };
+    ZSTD_outBuffer o = { out, outlen, 0 };
+    size_t before = 0, rc = 0;
+
+    while (o.pos < o.size) {
+        before = in.pos + o.pos;
+        rc = ZSTD_decompressStream(d->s.zstd, &o, &in);
+        if (ZSTD_isError(rc) && ZSTD_getErrorCode(rc) == ZSTD_error_frameParameter_windowTooLarge) {
+            log_err("ERROR: the zstd input needs more than the %zu KiB allowed to decode (see --max-memory)", decode_limit >> 10);
+            return -1;
+        }
+        if (ZSTD_isError(rc)) return -1;
+        if (in.pos + o.pos == before) break;
+
+        // 0 is the end of a frame, with all of it flushed:
+        d->ended = (rc == 0);
+    }
+
+    *src += in.pos;
+    *srclen -= in.pos;
+
+    return o.pos;
+}
+#endif
+
+// Decode as much of the SRCLEN bytes at *SRC as fits in the OUTLEN bytes at
+// OUT, moving *SRC past the input used up.  FINISH says no input follows
+// *SRC.  Returns the bytes decoded, or -1 if the input is corrupt:
+ssize_t FC_decoder_run(FC_decoder *d, const char **src, size_t *srclen, char *out, size_t outlen, int finish)
+{
+    assert(d != NULL && src != NULL && srclen != NULL && out != NULL);
+
+    // Not every format needs them (or is built in):
+    (void)outlen;
+    (void)finish;
+
+    switch (d->format) {
+#ifdef FC_GZIP
+        case FC_DECODE_GZIP:
+            return gzip_run(d, src, srclen, out, outlen);
+#endif
+#ifdef FC_BZIP2
+        case FC_DECODE_BZIP2:
+            return bzip2_run(d, src, srclen, out, outlen);
+#endif
+#ifdef FC_XZ
+        case FC_DECODE_XZ:
+            return xz_run(d, src, srclen, out, outlen, finish);
+#endif
+#ifdef FC_ZSTD
+        case FC_DECODE_ZSTD:
+            return zstd_run(d, src, srclen, out, outlen);
+#endif
+    }
+
+    return -1;
+}
+
+// Is D at the end of its input, rather than partway through (truncated)?
+int FC_decoder_ended(FC_decoder *d)
+{
+    assert(d != NULL);
+
+    return d->ended;
+}
+
+void FC_decoder_destroy(FC_decoder *d)
+{
+    if (d == NULL) return;
+
+    switch (d->format) {
+#ifdef FC_GZIP
+        case FC_DECODE_GZIP:
+            inflateEnd(&d->s.z);
+            break;
+#endif
+#ifdef FC_BZIP2
+        case FC_DECODE_BZIP2:
+            BZ2_bzDecompressEnd(&d->s.bz);
+            break;
+#endif
+#ifdef FC_XZ
+        case FC_DECODE_XZ:
+            lzma_end(&d->s.xz);
+            break;
+#endif
+#ifdef FC_ZSTD
+        case FC_DECODE_ZSTD:
+            ZSTD_freeDStream(d->s.zstd);
+            break;
+#endif
+    }
+
+    free(d);
+}
+
+// Little-endian integers, as gzip and zstd store them:
+static size_t get16(const char *p)
+{
+    const unsigned char *u = (const unsigned char *)p;
+
+    return u[0] | (size_t)u[1] << 8;
+}
+
+static size_t get32(const char *p)
+{
+    const unsigned char *u = (const unsigned char *)p;
+
+    return u[0] | (size_t)u[1] << 8 | (size_t)u[2] << 16 | (size_t)u[3] << 24;
+}
+
+#ifdef FC_GZIP
+// The compressed and decoded length of the BGZF member at P, which must
+// have a "BC" extra field with its length (and at most 64K of it, so the
+// length in its trailer, which is modulo 4G, is the whole of it):
+static int bgzf_member(const char *p, size_t len, size_t *clen, size_t *size)
+{
+    size_t xlen = 0;
+    size_t i = 0;
+
+    if (len < 18 || memcmp(p, "\x1f\x8b\x08", 3) != 0 || !(p[3] & 4)) return -1;
+
+    xlen = get16(p + 10);
+    if (12 + xlen > len) return -1;
+
+    for (i = 12; i + 4 <= 12 + xlen; i += 4 + get16(p + i + 2)) {
+        if (p[i] != 'B' || p[i + 1] != 'C' || get16(p + i + 2) != 2) continue;
+        if (i + 6 > 12 + xlen) return -1;
+
+        *clen = get16(p + i + 4) + 1;
+        if (*clen < 12 + xlen + 8 || *clen > len) return -1;
+        *size = get32(p + *clen - 4);
+
+        return 0;
+    }
+
+    return -1;
+}
+#endif
+
+#ifdef FC_ZSTD
+#define ZSTD_SKIPPABLE_MAGIC 0x184D2A5E
+#define ZSTD_SEEKABLE_MAGIC  0x8F92EAB1
+
+// The compressed and decoded length of the zstd frame at P, if its content
+// size was recorded (skippable frames decode to nothing):
+static int zstd_frame(const char *p, size_t len, size_t *clen, size_t *size)
+{
+    unsigned long long n = ZSTD_getFrameContentSize(p, len);
+    size_t c = ZSTD_findFrameCompressedSize(p, len);
+
+    if (n == ZSTD_CONTENTSIZE_UNKNOWN || n == ZSTD_CONTENTSIZE_ERROR || ZSTD_isError(c)) return -1;
+    if (n > (size_t)-1) return -1;
+
+    *clen = c;
+    *size = n;
+
+    return 0;
+}
+
+// The number of frames in the seek table at the end of DATA (in the zstd
+// seekable format), and where the table starts (*TABLE) and how long each
+// entry is (*ENTRY), or 0 if there is no table:
+static size_t zstd_seek_table(const char *data, size_t len, size_t *table, size_t *entry)
+{
+    size_t frames = 0;
+    size_t start = 0;
+
+    if (len < 17 || get32(data + len - 4) != ZSTD_SEEKABLE_MAGIC) return 0;
+
+    frames = get32(data + len - 9);
+    *entry = (data[len - 5] & 0x80) ? 12 : 8;
+    if (frames == 0 || frames > (len - 17) / *entry) return 0;
+
+    start = len - 9 - frames * *entry;
+    if (get32(data + start - 8) != ZSTD_SKIPPABLE_MAGIC || get32(data + start - 4) != len - start) return 0;
+
+    *table = start;
+
+    return frames;
+}
+#endif
+
+// Cut the LEN bytes of compressed DATA, in FORMAT, into runs of whole
+// members, each decoding to at most MOST bytes (and at least one member,
+// unless one is longer than that).  Sets *CHUNKS (to be freed) and *COUNT,
+// or returns -1 if the members can't be found (or are too long) without
+// decoding them:
+int FC_decode_chunks(int format, const char *data, size_t len, size_t most, FC_chunk **chunks, size_t *count)
+{
+    FC_chunk *c = NULL;
+    size_t n = 0;           // chunks found
+    size_t max = 0;         // ...and the room for them
+    size_t pos = 0;         // the next member
+    size_t end = len;       // the end of the members
+    size_t clen = 0;
+    size_t size = 0;
+    size_t frames = 0;      // the frames in a zstd seek table
+    size_t table = 0;
+    size_t entry = 0;
+    size_t i = 0;
+    int rc = -1;
+
+    assert(data != NULL && chunks != NULL && count != NULL && most > 0);
+
+    (void)table;
+    (void)entry;
+
+#ifdef FC_ZSTD
+    if (format == FC_DECODE_ZSTD) {
+        frames = zstd_seek_table(data, len, &table, &entry);
+        if (frames > 0) end = table - 8;
+    }
+#endif
+
+    while (pos < end) {
+        rc = -1;
+
+#ifdef FC_GZIP
+        if (format == FC_DECODE_GZIP) {
+            rc = bgzf_member(data + pos, end - pos, &clen, &size);
+        }
+#endif
+#ifdef FC_ZSTD
+        if (format == FC_DECODE_ZSTD && frames > 0) {
+            check_debug(i < frames, "zstd seek table is short: decoding on one thread");
+            clen = get32(data + table + i * entry);
+            size = get32(data + table + i * entry + 4);
+            rc = (clen <= end - pos) ? 0 : -1;
+            i++;
+        }
+        else if (format == FC_DECODE_ZSTD) {
+            rc = zstd_frame(data + pos, end - pos, &clen, &size);
+        }
+#endif
+
+        check_debug(rc == 0 && clen > 0, "%s member at %zu has no length: decoding on one thread", FC_decode_name(format), pos);
+        check_debug(size <= most, "%s member at %zu is longer than a block: decoding on one thread", FC_decode_name(format), pos);
+
+        // Start a new chunk, unless the member fits in the last one:
+        if (n == 0 || c[n - 1].size + size > most) {
+            if (n == max) {
+                FC_chunk *more = realloc(c, (max ? 2 * max : 64) * sizeof(FC_chunk));
+                check_mem(more);
+                c = more;
+                max = max ? 2 * max : 64;
+            }
+
+            c[n].offset = pos;
+            c[n].len = 0;
+            c[n].size = 0;
+            n++;
+        }
+
+        c[n - 1].len += clen;
+        c[n - 1].size += size;
+        pos += clen;
+    }
+
+    check_debug(frames == 0 || i == frames, "zstd seek table is too long: decoding on one thread");
+
+    *chunks = c;
+    *count = n;
+
+    return 0;
+
+error:
+    free(c);
+    return -1;
+}
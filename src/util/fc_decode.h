@@ -0,0 +1,41 @@
+#ifndef _FC_decode_h
+#define _FC_decode_h
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// Compressed formats, told apart by their magic bytes:
+#define FC_DECODE_NONE  0
+#define FC_DECODE_GZIP  1
+#define FC_DECODE_BZIP2 2
+#define FC_DECODE_XZ    3
+#define FC_DECODE_ZSTD  4
+
+// A streaming decompressor for one of them:
+typedef struct FC_decoder FC_decoder;
+
+// A run of whole members (or frames) of a compressed file, which decodes
+// on its own:
+typedef struct FC_chunk {
+    size_t offset;      // where it starts in the file
+    size_t len;         // its compressed length
+    size_t size;        // ...and its decoded length
+} FC_chunk;
+
+int FC_decode_format(const char *p, size_t len);
+
+const char *FC_decode_name(int format);
+
+void FC_decode_limit(size_t bytes);
+
+FC_decoder *FC_decoder_create(int format);
+
+ssize_t FC_decoder_run(FC_decoder *d, const char **src, size_t *srclen, char *out, size_t outlen, int finish);
+
+int FC_decoder_ended(FC_decoder *d);
+
+void FC_decoder_destroy(FC_decoder *d);
+
+int FC_decode_chunks(int format, const char *data, size_t len, size_t most, FC_chunk **chunks, size_t *count);
+
+#endif
@@ -0,0 +1,180 @@
+// -------------------------------------------------------------------------
+// Runtime CPU dispatch.
+//
+// fcount is built for the baseline instruction set of the target, and the
+// wider kernels are compiled with function-level target attributes.  At
+// startup the CPU (and OS register-state support) is probed with cpuid, and
+// the best engine it can run is bound, unless one is named with --engine.
+// -------------------------------------------------------------------------
+#include <assert.h>
+#include <string.h>
+#include "util/dbg.h"
+#include "util/fc_engine.h"
+
+#ifdef FC_X86
+#include <cpuid.h>
+#endif
+
+const FC_engine FC_engines[] = {
+    { "scalar",   0,
+                  FC_scan_scalar, FC_expect_scalar, FC_lines_scalar, FC_match_scalar,
+                  { FC_csv_scalar, FC_csv_scalar, FC_csv_scalar }, FC_sniff_scalar },
+#ifdef FC_X86
+    { "sse2",     FC_CPU_SSE2,
+                  FC_scan_sse2, FC_expect_sse2, FC_lines_sse2, FC_match_sse2,
+                  { FC_csv_sse2, FC_csv_sse2_comma, FC_csv_sse2_tab }, FC_sniff_sse2 },
+    { "sse4.2",   FC_CPU_SSE2 | FC_CPU_SSE42 | FC_CPU_POPCNT,
+                  FC_scan_sse42, FC_expect_sse42, FC_lines_sse2, FC_match_sse42,
+                  { FC_csv_sse42, FC_csv_sse42_comma, FC_csv_sse42_tab }, FC_sniff_sse42 },
+    { "avx2",     FC_CPU_SSE2 | FC_CPU_SSE42 | FC_CPU_POPCNT | FC_CPU_PCLMUL | FC_CPU_AVX2,
+                  FC_scan_avx2, FC_expect_avx2, FC_lines_avx2, FC_match_avx2,
+                  { FC_csv_avx2, FC_csv_avx2_comma, FC_csv_avx2_tab }, FC_sniff_avx2 },
+    { "avx512bw", FC_CPU_SSE2 | FC_CPU_SSE42 | FC_CPU_POPCNT | FC_CPU_PCLMUL | FC_CPU_AVX2 | FC_CPU_AVX512BW,
+                  FC_scan_avx512, FC_expect_avx512, FC_lines_avx512, FC_match_avx512,
+                  { FC_csv_avx512, FC_csv_avx512_comma, FC_csv_avx512_tab }, FC_sniff_avx512 },
+#endif
+    { NULL, 0, NULL, NULL, NULL, NULL, { NULL }, NULL }
+};
+
+static const struct {
+    unsigned int bit;
+    const char *name;
+} cpu_feature_names[] = {
+    { FC_CPU_SSE2,       "sse2" },
+    { FC_CPU_SSE42,      "sse4.2" },
+    { FC_CPU_POPCNT,     "popcnt" },
+    { FC_CPU_PCLMUL,     "pclmul" },
+    { FC_CPU_AVX2,       "avx2" },
+    { FC_CPU_AVX512BW,   "avx512bw" },
+    { FC_CPU_AVX512VBMI, "avx512vbmi" },
+    { 0, NULL }
+};
+
+static const FC_engine *current_engine = NULL;
+
+#ifdef FC_X86
+// Which register state has the OS enabled (XCR0)?
+static unsigned long long xgetbv(void)
+{
+    unsigned int eax = 0, edx = 0;
+
+    __asm__ volatile ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+
+    return ((unsigned long long)edx << 32) | eax;
+}
+#endif
+
+static unsigned int cpu_detect(void)
+{
+    unsigned int features = 0;
+
+#ifdef FC_X86
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    unsigned long long xcr0 = 0;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return 0;
+
+    if (edx & bit_SSE2)   features |= FC_CPU_SSE2;
+    if (ecx & bit_SSE4_2) features |= FC_CPU_SSE42;
+    if (ecx & bit_POPCNT) features |= FC_CPU_POPCNT;
+    if (ecx & bit_PCLMUL) features |= FC_CPU_PCLMUL;
+
+    // The YMM/ZMM registers are only usable if the OS saves them:
+    if (!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX)) return features;
+    xcr0 = xgetbv();
+    if ((xcr0 & 0x06) != 0x06) return features;
+
+    if (__get_cpuid_max(0, NULL) < 7) return features;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+    if (ebx & bit_AVX2) features |= FC_CPU_AVX2;
+
+    if ((xcr0 & 0xe6) == 0xe6 && (ebx & bit_AVX512F) && (ebx & bit_AVX512BW)) {
+        features |= FC_CPU_AVX512BW;
+        if (ecx & bit_AVX512VBMI) features |= FC_CPU_AVX512VBMI;
+    }
+#endif
+
+    return features;
+}
+
+unsigned int FC_cpu_features(void)
+{
+    static int detected = 0;
+    static unsigned int features = 0;
+
+    if (!detected) {
+        features = cpu_detect();
+        detected = 1;
+    }
+
+    return features;
+}
+
+int FC_engine_supported(const FC_engine *engine)
+{
+    assert(engine != NULL);
+
+    return (engine->requires & FC_cpu_features()) == engine->requires;
+}
+
+// Bind the engine called NAME, or the best supported one if NAME is NULL:
+int FC_engine_select(const char *name)
+{
+    const FC_engine *e = NULL;
+    const FC_engine *found = NULL;
+
+    for (e = FC_engines; e->name != NULL; e++) {
+        if (name == NULL) {
+            if (FC_engine_supported(e)) found = e;
+        }
+        else if (strcmp(e->name, name) == 0) {
+            found = e;
+            break;
+        }
+    }
+
+    check(found != NULL, "ERROR: unknown engine: %s", name);
+    check(FC_engine_supported(found), "ERROR: engine %s is not supported by this CPU", found->name);
+
+    current_engine = found;
+    debug("engine: %s", current_engine->name);
+
+    return 0;
+
+error:
+    return -1;
+}
+
+const FC_engine *FC_engine_current(void)
+{
+    if (current_engine == NULL) FC_engine_select(NULL);
+
+    return current_engine;
+}
+
+// Describe the CPU, the engines available on it, and the one in use:
+void FC_engine_print(FILE *fp)
+{
+    unsigned int features = FC_cpu_features();
+    const FC_engine *e = NULL;
+    int i = 0;
+
+    fprintf(fp, "engine: %s\n", FC_engine_current()->name);
+
+    fprintf(fp, "cpu:");
+    for (i = 0; cpu_feature_names[i].name != NULL; i++) {
+        if (features & cpu_feature_names[i].bit) {
+            fprintf(fp, " %s", cpu_feature_names[i].name);
+        }
+    }
+    fprintf(fp, "\n");
+
+    fprintf(fp, "engines:");
+    for (e = FC_engines; e->name != NULL; e++) {
+        if (FC_engine_supported(e)) {
+            fprintf(fp, " %s", e->name);
+        }
+    }
+    fprintf(fp, "\n");
+}
@@ -0,0 +1,89 @@
+#ifndef _FC_engine_h
+#define _FC_engine_h
+
+#include <stdio.h>
+#include <util/fc_scan.h>
+#include <util/fc_csv.h>
+#include <util/fc_match.h>
+#include <util/fc_sniff.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FC_X86 1
+#endif
+
+// CPU features the scanning kernels may depend on:
+#define FC_CPU_SSE2         0x0001
+#define FC_CPU_SSE42        0x0002
+#define FC_CPU_POPCNT       0x0004
+#define FC_CPU_PCLMUL       0x0008
+#define FC_CPU_AVX2         0x0010
+#define FC_CPU_AVX512BW     0x0020
+#define FC_CPU_AVX512VBMI   0x0040
+
+// An engine binds one implementation of every scanning kernel, all built
+// for the same instruction-set level:
+typedef struct FC_engine {
+    const char *name;
+    unsigned int requires;      // the FC_CPU_* features the engine needs
+    FC_scan_kernel count;       // delimiter and record counting
+    FC_expect_kernel expect;    // checking records against one field count
+    FC_lines_kernel lines;      // newline counting (-l)
+    FC_match_kernel match;      // compound delimiter counting and checking
+    FC_csv_kernel csv[FC_CSV_VARIANTS]; // CSV field counting (-C), by FC_CSV_*
+    FC_sniff_kernel sniff;      // many delimiters at once (--sniff)
+} FC_engine;
+
+extern const FC_engine FC_engines[];
+
+unsigned int FC_cpu_features(void);
+
+int FC_engine_supported(const FC_engine *engine);
+
+int FC_engine_select(const char *name);
+
+const FC_engine *FC_engine_current(void);
+
+void FC_engine_print(FILE *fp);
+
+// The kernels themselves (see fc_scan.c, fc_match.c, fc_csv.c and fc_sniff.c):
+int FC_scan_scalar(FC_scan *s, const unsigned char *p, size_t len, FC_hist *hist);
+int FC_expect_scalar(FC_scan *s, const unsigned char *p, size_t len);
+unsigned long long FC_lines_scalar(const unsigned char *p, size_t len);
+int FC_match_scalar(FC_match *m, const unsigned char *p, size_t len, FC_hist *hist);
+int FC_sniff_scalar(FC_sniff *s, const unsigned char *p, size_t len);
+
+#ifdef FC_X86
+int FC_scan_sse2(FC_scan *s, const unsigned char *p, size_t len, FC_hist *hist);
+int FC_scan_sse42(FC_scan *s, const unsigned char *p, size_t len, FC_hist *hist);
+int FC_scan_avx2(FC_scan *s, const unsigned char *p, size_t len, FC_hist *hist);
+int FC_scan_avx512(FC_scan *s, const unsigned char *p, size_t len, FC_hist *hist);
+int FC_expect_sse2(FC_scan *s, const unsigned char *p, size_t len);
+int FC_expect_sse42(FC_scan *s, const unsigned char *p, size_t len);
+int FC_expect_avx2(FC_scan *s, const unsigned char *p, size_t len);
+int FC_expect_avx512(FC_scan *s, const unsigned char *p, size_t len);
+unsigned long long FC_lines_sse2(const unsigned char *p, size_t len);
+unsigned long long FC_lines_avx2(const unsigned char *p, size_t len);
+unsigned long long FC_lines_avx512(const unsigned char *p, size_t len);
+int FC_match_sse2(FC_match *m, const unsigned char *p, size_t len, FC_hist *hist);
+int FC_match_sse42(FC_match *m, const unsigned char *p, size_t len, FC_hist *hist);
+int FC_match_avx2(FC_match *m, const unsigned char *p, size_t len, FC_hist *hist);
+int FC_match_avx512(FC_match *m, const unsigned char *p, size_t len, FC_hist *hist);
+int FC_csv_sse2(FC_csv *c, const unsigned char *p, size_t len, FC_hist *hist);
+int FC_csv_sse2_comma(FC_csv *c, const unsigned char *p, size_t len, FC_hist *hist);
+int FC_csv_sse2_tab(FC_csv *c, const unsigned char *p, size_t len, FC_hist *hist);
+int FC_csv_sse42(FC_csv *c, const unsigned char *p, size_t len, FC_hist *hist);
+int FC_csv_sse42_comma(FC_csv *c, const unsigned char *p, size_t len, FC_hist *hist);
+int FC_csv_sse42_tab(FC_csv *c, const unsigned char *p, size_t len, FC_hist *hist);
+int FC_csv_avx2(FC_csv *c, const unsigned char *p, size_t len, FC_hist *hist);
+int FC_csv_avx2_comma(FC_csv *c, const unsigned char *p, size_t len, FC_hist *hist);
+int FC_csv_avx2_tab(FC_csv *c, const unsigned char *p, size_t len, FC_hist *hist);
+int FC_csv_avx512(FC_csv *c, const unsigned char *p, size_t len, FC_hist *hist);
+int FC_csv_avx512_comma(FC_csv *c, const unsigned char *p, size_t len, FC_hist *hist);
+int FC_csv_avx512_tab(FC_csv *c, const unsigned char *p, size_t len, FC_hist *hist);
+int FC_sniff_sse2(FC_sniff *s, const unsigned char *p, size_t len);
+int FC_sniff_sse42(FC_sniff *s, const unsigned char *p, size_t len);
+int FC_sniff_avx2(FC_sniff *s, const unsigned char *p, size_t len);
+int FC_sniff_avx512(FC_sniff *s, const unsigned char *p, size_t len);
+#endif
+
+#endif
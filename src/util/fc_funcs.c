@@ -4,7 +4,7 @@
 
 
 // A function to create FCount struct instances:
-struct FCount *FC_create (int fieldcount, int recordcount)
+struct FCount *FC_create (unsigned long fieldcount, unsigned long long recordcount)
 {
     FCount *fc = malloc(sizeof(FCount));
 
@@ -46,18 +46,24 @@ void FC_array_destroy(DArray *darray)
     DArray_destroy(darray);
 }
 
-// Print an instance of FCount:
-void FC_print(FCount *fc, char *filename)
+// Print an instance of FCount to a stream:
+void FC_fprint(FILE *fp, FCount *fc, char *filename)
 {
     // Did we get a valid pointer passed in?
     assert(fc != NULL);
 
     // Print it:
-    printf("%d\t%d\t%s\n", fc->fieldcount, fc->recordcount, filename);
+    fprintf(fp, "%lu\t%llu\t%s\n", fc->fieldcount, fc->recordcount, filename);
 }
 
-// Print an array of FCount elements:
-void FC_array_print(DArray *darray, char *filename)
+// Print an instance of FCount:
+void FC_print(FCount *fc, char *filename)
+{
+    FC_fprint(stdout, fc, filename);
+}
+
+// Print an array of FCount elements to a stream:
+void FC_array_fprint(FILE *fp, DArray *darray, char *filename)
 {
     int i = 0;
 
@@ -66,19 +72,25 @@ void FC_array_print(DArray *darray, char *filename)
 
     // Loop through the array:
     for (i = 0; i < darray->end; i++) {
-        FC_print( (FCount *)(darray->contents[i]), filename );
+        FC_fprint(fp, (FCount *)(darray->contents[i]), filename);
     }
 
 }
 
-int FC_array_push(DArray *darray, int fieldcount)
+// Print an array of FCount elements:
+void FC_array_print(DArray *darray, char *filename)
+{
+    FC_array_fprint(stdout, darray, filename);
+}
+
+int FC_array_push(DArray *darray, unsigned long fieldcount)
 {
     assert(darray != NULL);
     int i = 0;
     int found = 0;
 
     for (i = 0; i < darray->end; i++) {
-        int array_fieldcount = ( (FCount *)(darray->contents[i]) )->fieldcount;
+        unsigned long array_fieldcount = ( (FCount *)(darray->contents[i]) )->fieldcount;
 
         if ( fieldcount == array_fieldcount ) {
             ((FCount *)(darray->contents[i]))->recordcount++;
@@ -100,11 +112,12 @@ error:
 int FC_cmp(const void *a, const void *b)
 {
     // a is a pointer to an element of an array holding a pointer to a struct:
-    int x = (*(FCount **)a)->recordcount;
-    int y = (*(FCount **)b)->recordcount;
+    unsigned long long x = (*(FCount **)a)->recordcount;
+    unsigned long long y = (*(FCount **)b)->recordcount;
 
-    debug("x = %d, y = %d, x-y = %d", x, y, x-y);
-    return (y - x);
+    // (Descending, without the overflow of y - x on 64-bit counts:)
+    debug("x = %llu, y = %llu", x, y);
+    return (x < y) - (x > y);
 }
 
 int FC_array_sort(DArray *darray, FC_compare FC_cmp)
@@ -1,24 +1,30 @@
 #ifndef _FC_funcs_h
 #define _FC_funcs_h
 
+#include <stdio.h>
+
 typedef struct FCount {
-    int fieldcount;
-    int recordcount;
+    unsigned long fieldcount;
+    unsigned long long recordcount;
 } FCount;
 
 typedef int (*FC_compare) (const void *a, const void *b);
 
-FCount *FC_create (int fieldcount, int recordcount);
+FCount *FC_create (unsigned long fieldcount, unsigned long long recordcount);
 
 void FC_destroy(FCount *fc);
 
 void FC_array_destroy(DArray *darray);
 
+void FC_fprint(FILE *fp, FCount *fc, char *filename);
+
 void FC_print(FCount *fc, char *filename);
 
+void FC_array_fprint(FILE *fp, DArray *darray, char *filename);
+
 void FC_array_print(DArray *darray, char *filename);
 
-int FC_array_push(DArray *darray, int fieldcount);
+int FC_array_push(DArray *darray, unsigned long fieldcount);
 
 int FC_cmp(const void *a, const void *b);
 
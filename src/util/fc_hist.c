@@ -0,0 +1,274 @@
+// -------------------------------------------------------------------------
+// A histogram of records by field count.
+//
+// Counting a record is a single increment of a flat array for field counts
+// below FC_HIST_DENSE, and a probe of a linear-probing hash table above it.
+// The distinct field counts are also kept in the order they were first
+// seen, which is the order FC_array_push() used to build its array in, so
+// the sorted output (ties included) doesn't change.
+//
+// All counts are 64-bit.  A histogram can be saved to a file and loaded
+// back (adding to what is already counted), so the partial counts of
+// threads, byte ranges or hosts combine exactly.  The encoding is compact:
+//
+//     "FCH1" <n> <fieldcount 1> <records 1> ... <fieldcount n> <records n>
+//
+// where every number is an unsigned LEB128 varint (7 bits per byte, low
+// bits first, the high bit set on all but the last byte), and the field
+// counts are in first-seen order.
+// -------------------------------------------------------------------------
+#include <stdint.h>
+#include <string.h>
+#include "util/darray.h"
+#include "util/dbg.h"
+#include "util/fc_funcs.h"
+#include "util/fc_hist.h"
+
+FC_hist *FC_hist_create(void)
+{
+    FC_hist *h = calloc(1, sizeof(FC_hist));
+    check_mem(h);
+
+    return h;
+
+error:
+    return NULL;
+}
+
+void FC_hist_destroy(FC_hist *h)
+{
+    // Did we get a valid pointer passed in?
+    assert(h != NULL);
+
+    free(h->slots);
+    free(h->seen);
+    free(h);
+}
+
+// Remember a field count seen for the first time:
+int FC_hist_first(FC_hist *h, unsigned long fieldcount)
+{
+    if (h->nseen == h->maxseen) {
+        size_t max = h->maxseen ? 2 * h->maxseen : 16;
+        unsigned long *seen = realloc(h->seen, max * sizeof(unsigned long));
+        check_mem(seen);
+
+        h->seen = seen;
+        h->maxseen = max;
+    }
+
+    h->seen[h->nseen++] = fieldcount;
+
+    return 0;
+
+error:
+    return -1;
+}
+
+// The slot holding FIELDCOUNT, or the empty slot where it belongs:
+static FC_hist_slot *hist_find(const FC_hist *h, unsigned long fieldcount)
+{
+    size_t mask = h->nslots - 1;
+    size_t i = (size_t)(((uint64_t)fieldcount * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+
+    while (h->slots[i].fieldcount != 0 && h->slots[i].fieldcount != fieldcount) {
+        i = (i + 1) & mask;
+    }
+
+    return &h->slots[i];
+}
+
+static int hist_grow(FC_hist *h)
+{
+    FC_hist_slot *old = h->slots;
+    size_t oldn = h->nslots;
+    size_t i = 0;
+
+    h->nslots = oldn ? 2 * oldn : 64;
+    h->slots = calloc(h->nslots, sizeof(FC_hist_slot));
+    check_mem(h->slots);
+
+    for (i = 0; i < oldn; i++) {
+        if (old[i].fieldcount != 0) {
+            *hist_find(h, old[i].fieldcount) = old[i];
+        }
+    }
+
+    free(old);
+
+    return 0;
+
+error:
+    h->slots = old;
+    h->nslots = oldn;
+    return -1;
+}
+
+// Count RECORDS records with FIELDCOUNT fields:
+int FC_hist_add_n(FC_hist *h, unsigned long fieldcount, unsigned long long records)
+{
+    FC_hist_slot *slot = NULL;
+
+    assert(h != NULL);
+
+    if (records == 0) return 0;
+
+    if (fieldcount < FC_HIST_DENSE) {
+        if (h->dense[fieldcount] == 0) {
+            check(FC_hist_first(h, fieldcount) == 0, "Error adding a field count.");
+        }
+        h->dense[fieldcount] += records;
+
+        return 0;
+    }
+
+    // Keep the table at most half full:
+    if (2 * (h->used + 1) > h->nslots) {
+        check(hist_grow(h) == 0, "Error growing the field-count table.");
+    }
+
+    slot = hist_find(h, fieldcount);
+
+    if (slot->fieldcount == 0) {
+        check(FC_hist_first(h, fieldcount) == 0, "Error adding a field count.");
+        slot->fieldcount = fieldcount;
+        h->used++;
+    }
+    slot->recordcount += records;
+
+    return 0;
+
+error:
+    return -1;
+}
+
+// The number of records with FIELDCOUNT fields:
+unsigned long long FC_hist_get(const FC_hist *h, unsigned long fieldcount)
+{
+    assert(h != NULL);
+
+    if (fieldcount < FC_HIST_DENSE) {
+        return h->dense[fieldcount];
+    }
+
+    if (h->nslots == 0) {
+        return 0;
+    }
+
+    return hist_find(h, fieldcount)->recordcount;
+}
+
+// Add the counts in SRC to DEST.  Field counts new to DEST are appended in
+// the order SRC first saw them, so merging the histograms of consecutive
+// parts of a file, in order, gives the histogram of a serial pass:
+int FC_hist_merge(FC_hist *dest, const FC_hist *src)
+{
+    size_t i = 0;
+
+    assert(dest != NULL && src != NULL);
+
+    for (i = 0; i < src->nseen; i++) {
+        unsigned long fieldcount = src->seen[i];
+        check(FC_hist_add_n(dest, fieldcount, FC_hist_get(src, fieldcount)) == 0, "Error merging field counts.");
+    }
+
+    return 0;
+
+error:
+    return -1;
+}
+
+// Append the histogram to an array of FCount elements (for sorting and
+// printing), in first-seen order:
+int FC_hist_to_array(const FC_hist *h, DArray *darray)
+{
+    size_t i = 0;
+
+    assert(h != NULL && darray != NULL);
+
+    for (i = 0; i < h->nseen; i++) {
+        FCount *fc = FC_create(h->seen[i], FC_hist_get(h, h->seen[i]));
+        check(DArray_push(darray, fc) == 0, "Error pushing element into darray.");
+    }
+
+    return 0;
+
+error:
+    return -1;
+}
+
+static int put_varint(unsigned long long v, FILE *fp)
+{
+    while (v >= 0x80) {
+        if (putc((int)(v & 0x7f) | 0x80, fp) == EOF) return -1;
+        v >>= 7;
+    }
+
+    return putc((int)v, fp) == EOF ? -1 : 0;
+}
+
+static int get_varint(unsigned long long *v, FILE *fp)
+{
+    unsigned int shift = 0;
+    int c = 0;
+
+    *v = 0;
+
+    do {
+        c = getc(fp);
+        if (c == EOF || shift > 63) return -1;
+
+        *v |= (unsigned long long)(c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+
+    return 0;
+}
+
+// Write the histogram to FP:
+int FC_hist_save(const FC_hist *h, FILE *fp)
+{
+    size_t i = 0;
+
+    assert(h != NULL && fp != NULL);
+
+    check(fwrite(FC_HIST_MAGIC, 1, 4, fp) == 4, "Error writing field counts.");
+    check(put_varint(h->nseen, fp) == 0, "Error writing field counts.");
+
+    for (i = 0; i < h->nseen; i++) {
+        check(put_varint(h->seen[i], fp) == 0, "Error writing field counts.");
+        check(put_varint(FC_hist_get(h, h->seen[i]), fp) == 0, "Error writing field counts.");
+    }
+
+    return 0;
+
+error:
+    return -1;
+}
+
+// Read a histogram written by FC_hist_save() from FP, and add it to H:
+int FC_hist_load(FC_hist *h, FILE *fp)
+{
+    char magic[4];
+    unsigned long long n = 0;
+    unsigned long long fieldcount = 0;
+    unsigned long long records = 0;
+
+    assert(h != NULL && fp != NULL);
+
+    check(fread(magic, 1, 4, fp) == 4 && memcmp(magic, FC_HIST_MAGIC, 4) == 0, "Not a saved field-count histogram.");
+    check(get_varint(&n, fp) == 0, "Truncated field-count histogram.");
+
+    for (; n > 0; n--) {
+        check(get_varint(&fieldcount, fp) == 0 && get_varint(&records, fp) == 0, "Truncated field-count histogram.");
+        check(fieldcount <= (unsigned long)-1, "Invalid field count in histogram.");
+        check(FC_hist_add_n(h, fieldcount, records) == 0, "Error loading field counts.");
+    }
+
+    check(getc(fp) == EOF, "Trailing data after field-count histogram.");
+
+    return 0;
+
+error:
+    return -1;
+}
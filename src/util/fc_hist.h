@@ -0,0 +1,65 @@
+#ifndef _FC_hist_h
+#define _FC_hist_h
+
+#include <stddef.h>
+#include <stdio.h>
+#include <util/darray.h>
+
+// Field counts below this are counted in a flat array; the (rare) larger
+// ones go to a small open-addressing hash table:
+#define FC_HIST_DENSE 256
+
+// The magic number at the start of a saved histogram:
+#define FC_HIST_MAGIC "FCH1"
+
+typedef struct FC_hist_slot {
+    unsigned long fieldcount;   // 0 marks an empty slot
+    unsigned long long recordcount;
+} FC_hist_slot;
+
+// A histogram of records by field count, which also remembers the order in
+// which the field counts were first seen:
+typedef struct FC_hist {
+    unsigned long long dense[FC_HIST_DENSE];
+    FC_hist_slot *slots;
+    size_t nslots;              // a power of two (or 0 before the first outlier)
+    size_t used;
+    unsigned long *seen;        // the distinct field counts, in first-seen order
+    size_t nseen;
+    size_t maxseen;
+} FC_hist;
+
+FC_hist *FC_hist_create(void);
+
+void FC_hist_destroy(FC_hist *h);
+
+int FC_hist_first(FC_hist *h, unsigned long fieldcount);
+
+int FC_hist_add_n(FC_hist *h, unsigned long fieldcount, unsigned long long records);
+
+unsigned long long FC_hist_get(const FC_hist *h, unsigned long fieldcount);
+
+int FC_hist_merge(FC_hist *dest, const FC_hist *src);
+
+int FC_hist_to_array(const FC_hist *h, DArray *darray);
+
+int FC_hist_save(const FC_hist *h, FILE *fp);
+
+int FC_hist_load(FC_hist *h, FILE *fp);
+
+#define FC_hist_distinct(H) ((H)->nseen)
+
+// Count one record with FIELDCOUNT fields:
+static inline int FC_hist_add(FC_hist *h, unsigned long fieldcount)
+{
+    if (fieldcount < FC_HIST_DENSE) {
+        if (h->dense[fieldcount]++ == 0) {
+            return FC_hist_first(h, fieldcount);
+        }
+        return 0;
+    }
+
+    return FC_hist_add_n(h, fieldcount, 1);
+}
+
+#endif
@@ -0,0 +1,853 @@
+// -------------------------------------------------------------------------
+// Block input for the scanning kernels.
+//
+// A regular file is mapped read-only into memory, and its blocks are just
+// windows of the mapping, so the kernels scan the page cache in place with
+// no copy into a user buffer.  Blocks are never written to, by the kernels
+// or anything else.  Pipes, terminals (and files that fail to map) are read
+// with read(2) into a large page-aligned buffer instead.
+//
+// The caller may ask for the last KEEP bytes of a block (e.g. a partial
+// record) to be carried over: they start the next block, followed by new
+// input.  When the input is exhausted, the next block holds only those
+// KEEP bytes.
+//
+// The read buffer isn't freed when an input is closed, but kept for the
+// next input opened on the same thread, so that counting many files (or
+// many pipes) allocates and faults in the buffer only once per thread.
+//
+// A pipe (or socket, or terminal) is read by a thread of its own, so that
+// whatever writes to it isn't stalled while a block is counted.  The reader
+// fills a ring of FC_INPUT_RING blocks, and the counting thread takes them
+// in turn.  Each side only ever moves its own end of the ring, and the
+// semaphores between them (one counting the free blocks, and one for each
+// block, posted when it's full) are all the synchronization there is: the
+// reader waits when the ring is full, and the counter when its next block
+// isn't.  Bytes carried over are copied into the head room in front of the
+// next block, so the blocks aren't copied.
+//
+// Compressed input (see fc_decode.c) goes through the same ring, but the
+// reader thread decodes it into the blocks: from the mapping of a regular
+// file, or from what it reads from a pipe, in which case the first block
+// read tells whether the pipe is compressed.  So decompression, too, keeps
+// pace with counting on a thread of its own.
+//
+// A mapped file that can be cut into chunks of whole members (BGZF, say)
+// may be decoded by several worker threads instead (FC_input_open_jobs),
+// since decoding is far slower than counting.  Each worker takes the next
+// chunk, and decodes it into the block of the ring the chunk falls on, so
+// the blocks fill out of order, but the counter still takes them in order.
+// A record cut in two by the end of a chunk is carried over into the next
+// block as any other, so it's counted exactly as the serial decoder would.
+// -------------------------------------------------------------------------
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "util/dbg.h"
+#include "util/fc_decode.h"
+#include "util/fc_input.h"
+
+// The spare read buffer of this thread, freed when the thread exits:
+static __thread char *spare = NULL;
+static __thread size_t spare_size = 0;
+static pthread_key_t spare_key;
+static pthread_once_t spare_once = PTHREAD_ONCE_INIT;
+
+static void spare_key_create(void)
+{
+    pthread_key_create(&spare_key, free);
+}
+
+static void spare_set(char *data, size_t size)
+{
+    pthread_once(&spare_once, spare_key_create);
+    pthread_setspecific(spare_key, data);
+
+    spare = data;
+    spare_size = size;
+}
+
+// Keep the read buffer DATA for the next input, unless the spare one is
+// already larger:
+static void spare_put(char *data, size_t size)
+{
+    if (spare != NULL && spare_size >= size) {
+        free(data);
+        return;
+    }
+
+    free(spare);
+    spare_set(data, size);
+}
+
+// Take the spare read buffer for IN, if it holds a block of BLOCKSIZE:
+static int spare_get(FC_input *in, size_t blocksize)
+{
+    if (spare == NULL || spare_size < blocksize) return -1;
+
+    in->data = spare;
+    in->size = spare_size;
+    spare_set(NULL, 0);
+
+    return 0;
+}
+
+// A block of the ring, read ahead from a pipe:
+typedef struct FC_slot {
+    char *buf;          // ROOM bytes of head room, then the block
+    size_t len;         // bytes read into the block
+    int eof;            // is it the last block?
+    int error;          // or the errno of a failed read
+    int corrupt;        // or was the input corrupt?
+    sem_t full;         // posted when the counter may take it
+} FC_slot;
+
+struct FC_ring;
+
+// A thread decoding chunks of a compressed file:
+typedef struct FC_worker {
+    struct FC_ring *ring;
+    FC_decoder *decoder;
+    pthread_t thread;
+} FC_worker;
+
+typedef struct FC_ring {
+    FC_slot *slots;
+    int nslots;
+    size_t room;        // head room in front of each block
+    sem_t free;         // slots the reader may fill
+    unsigned long head; // the next slot to fill (the reader's)
+    unsigned long tail; // the next slot to take (the counter's)
+    int held;           // does the counter still hold slot TAIL - 1?
+    int joined;         // or was the last block joined in the read buffer?
+    int done;           // has the counter taken the last block?
+    const char *last;   // the block last handed out
+    size_t last_len;
+    int fd;
+    size_t blocksize;
+    pthread_t reader;
+
+    // Compressed input only:
+    int detect;         // is a pipe to be checked for compression?
+    FC_decoder *decoder;
+    const char *src;    // the compressed input not decoded yet
+    size_t srclen;
+    int src_eof;        // has all of it been read?
+    char *srcbuf;       // what it's read into (from a pipe)
+    char *map;          // or the mapping of a compressed file
+    size_t map_size;
+
+    // Chunks decoded by workers (instead of the reader):
+    FC_chunk *chunks;
+    size_t nchunks;
+    FC_worker *workers;
+    int nworkers;
+    int started;        // the workers started
+} FC_ring;
+
+static void sem_wait_intr(sem_t *sem)
+{
+    while (sem_wait(sem) != 0 && errno == EINTR);
+}
+
+// Fill SLOT with a block read from the pipe:
+static void ring_read(FC_ring *r, FC_slot *slot)
+{
+    ssize_t n = 0;
+
+    while (slot->len < r->blocksize) {
+        n = read(r->fd, slot->buf + r->room + slot->len, r->blocksize - slot->len);
+
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) slot->error = errno;
+        if (n <= 0) {
+            slot->eof = 1;
+            break;
+        }
+
+        slot->len += n;
+    }
+}
+
+// Fill SLOT with a block decoded from the compressed input:
+static void ring_decode(FC_ring *r, FC_slot *slot)
+{
+    size_t srclen = 0;
+    ssize_t n = 0;
+
+    while (slot->len < r->blocksize) {
+        if (r->srclen == 0 && !r->src_eof) {
+            n = read(r->fd, r->srcbuf, r->blocksize);
+
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) {
+                slot->error = errno;
+                slot->eof = 1;
+                break;
+            }
+
+            r->src = r->srcbuf;
+            r->srclen = n;
+            r->src_eof = (n == 0);
+        }
+
+        srclen = r->srclen;
+        n = FC_decoder_run(r->decoder, &r->src, &r->srclen, slot->buf + r->room + slot->len, r->blocksize - slot->len, r->src_eof);
+        if (n < 0) {
+            slot->corrupt = 1;
+            slot->eof = 1;
+            break;
+        }
+
+        slot->len += n;
+
+        // Nothing more comes out at the end of the input, which must be the
+        // end of the last member, too:
+        if (n == 0 && r->srclen == srclen) {
+            if (r->srclen == 0 && !r->src_eof) continue;
+
+            slot->corrupt = !(r->src_eof && r->srclen == 0 && FC_decoder_ended(r->decoder));
+            slot->eof = 1;
+            break;
+        }
+    }
+}
+
+// Decode a compressed input of FORMAT, starting with the LEN bytes of its
+// SRC (the whole of it, if SRC_EOF):
+static int ring_decode_start(FC_ring *r, int format, const char *src, size_t len, int src_eof)
+{
+    debug("decoding %s input", FC_decode_name(format));
+
+    r->decoder = FC_decoder_create(format);
+    check(r->decoder != NULL, "Error starting decompression.");
+
+    if (!src_eof) {
+        r->srcbuf = malloc(r->blocksize);
+        check_mem(r->srcbuf);
+        memcpy(r->srcbuf, src, len);
+        src = r->srcbuf;
+    }
+
+    r->src = src;
+    r->srclen = len;
+    r->src_eof = src_eof;
+
+    return 0;
+
+error:
+    return -1;
+}
+
+// The reader thread: fill each free slot with a block, until the end of
+// the input (or an error):
+static void *ring_reader(void *arg)
+{
+    FC_ring *r = arg;
+    FC_slot *slot = NULL;
+    int format = FC_DECODE_NONE;
+
+    do {
+        sem_wait_intr(&r->free);
+        slot = &r->slots[r->head % r->nslots];
+        slot->len = 0;
+
+        if (r->decoder) {
+            ring_decode(r, slot);
+        }
+        else {
+            ring_read(r, slot);
+        }
+
+        // Decode the pipe from its first block on, if it's compressed:
+        if (r->detect) {
+            r->detect = 0;
+            format = FC_decode_format(slot->buf + r->room, slot->len);
+
+            if (format != FC_DECODE_NONE && slot->error == 0) {
+                if (ring_decode_start(r, format, slot->buf + r->room, slot->len, 0) == 0) {
+                    r->src_eof = slot->eof;
+                    slot->len = 0;
+                    slot->eof = 0;
+                    ring_decode(r, slot);
+                }
+                else {
+                    slot->corrupt = 1;
+                    slot->eof = 1;
+                }
+            }
+        }
+
+        r->head++;
+        sem_post(&slot->full);
+    } while (!slot->eof);
+
+    return NULL;
+}
+
+// A worker thread: decode the next chunk into its slot, until there are no
+// more chunks (or one is corrupt).  The slot is free once a free one has
+// been waited for, since slots are freed in order:
+static void *ring_worker(void *arg)
+{
+    FC_worker *w = arg;
+    FC_ring *r = w->ring;
+    FC_slot *slot = NULL;
+    FC_chunk *chunk = NULL;
+    const char *src = NULL;
+    size_t srclen = 0;
+    unsigned long next = 0;
+    ssize_t n = 0;
+
+    for (;;) {
+        sem_wait_intr(&r->free);
+        next = __atomic_fetch_add(&r->head, 1, __ATOMIC_RELAXED);
+        if (next >= r->nchunks) break;
+
+        slot = &r->slots[next % r->nslots];
+        chunk = &r->chunks[next];
+        src = r->map + chunk->offset;
+        srclen = chunk->len;
+
+        // Whatever the members said they'd decode to, they must:
+        n = FC_decoder_run(w->decoder, &src, &srclen, slot->buf + r->room, r->blocksize, 1);
+        slot->corrupt = (n != (ssize_t)chunk->size || srclen > 0 || !FC_decoder_ended(w->decoder));
+        slot->len = slot->corrupt ? 0 : n;
+        slot->eof = slot->corrupt || next == r->nchunks - 1;
+
+        sem_post(&slot->full);
+        if (slot->corrupt) break;
+    }
+
+    return NULL;
+}
+
+static void ring_destroy(FC_ring *r)
+{
+    int i = 0;
+
+    if (r->slots) {
+        for (i = 0; i < r->nslots; i++) {
+            free(r->slots[i].buf);
+            sem_destroy(&r->slots[i].full);
+        }
+        free(r->slots);
+    }
+
+    if (r->workers) {
+        for (i = 0; i < r->nworkers; i++) {
+            FC_decoder_destroy(r->workers[i].decoder);
+        }
+        free(r->workers);
+    }
+    free(r->chunks);
+
+    FC_decoder_destroy(r->decoder);
+    free(r->srcbuf);
+    if (r->map) munmap(r->map, r->map_size);
+
+    sem_destroy(&r->free);
+    free(r);
+}
+
+// A ring of NSLOTS blocks for IN, taking over its mapping (if any):
+static FC_ring *ring_create(FC_input *in, int nslots)
+{
+    long pagesize = sysconf(_SC_PAGESIZE);
+    FC_ring *r = calloc(1, sizeof(FC_ring));
+    void *buf = NULL;
+    int i = 0;
+
+    check_mem(r);
+    if (pagesize <= 0) pagesize = 4096;
+
+    r->room = pagesize;
+    r->fd = in->fd;
+    r->blocksize = in->blocksize;
+    sem_init(&r->free, 0, nslots);
+
+    r->slots = calloc(nslots, sizeof(FC_slot));
+    check_mem(r->slots);
+
+    for (i = 0; i < nslots; i++) {
+        check(posix_memalign(&buf, pagesize, r->room + r->blocksize) == 0, "Out of memory.");
+        r->slots[i].buf = buf;
+        sem_init(&r->slots[i].full, 0, 0);
+        r->nslots++;
+    }
+
+    if (in->mapped) {
+        r->map = in->data;
+        r->map_size = in->size;
+        in->mapped = 0;
+        in->data = NULL;
+        in->size = 0;
+    }
+
+    return r;
+
+error:
+    if (r) ring_destroy(r);
+    return NULL;
+}
+
+// Start reading IN ahead into a ring of blocks.  If it's compressed in
+// FORMAT, it's decoded from its mapping, or else from what is read after
+// the LEN bytes at PREFIX.  A pipe of no known FORMAT is checked once its
+// first block is read:
+static int ring_start(FC_input *in, int format, const char *prefix, size_t len)
+{
+    FC_ring *r = ring_create(in, FC_INPUT_RING);
+
+    check(r != NULL, "Error allocating input buffers.");
+
+    if (r->map) {
+        check(ring_decode_start(r, format, r->map, r->map_size, 1) == 0, "Error starting decompression.");
+    }
+    else if (format != FC_DECODE_NONE) {
+        check(ring_decode_start(r, format, prefix, len, 0) == 0, "Error starting decompression.");
+    }
+    else {
+        r->detect = 1;
+    }
+
+    check(pthread_create(&r->reader, NULL, ring_reader, r) == 0, "Error starting the reader thread.");
+    in->ring = r;
+
+    return 0;
+
+error:
+    if (r) ring_destroy(r);
+    return -1;
+}
+
+// Decode the mapped file IN, compressed in FORMAT, on JOBS worker threads,
+// if it can be cut into CHUNKS (of which there are NCHUNKS).  Each worker
+// decodes into a slot of its own while the counter takes another, so there
+// are two slots for each:
+static int ring_start_chunks(FC_input *in, int format, FC_chunk *chunks, size_t nchunks, int jobs)
+{
+    FC_ring *r = ring_create(in, 2 * jobs);
+    int i = 0;
+
+    check(r != NULL, "Error allocating input buffers.");
+    in->ring = r;
+
+    debug("decoding %s input in %zu chunks on %d threads", FC_decode_name(format), nchunks, jobs);
+
+    r->chunks = chunks;
+    r->nchunks = nchunks;
+    r->workers = calloc(jobs, sizeof(FC_worker));
+    check_mem(r->workers);
+    r->nworkers = jobs;
+
+    for (i = 0; i < jobs; i++) {
+        r->workers[i].ring = r;
+        r->workers[i].decoder = FC_decoder_create(format);
+        check(r->workers[i].decoder != NULL, "Error starting decompression.");
+    }
+
+    for (i = 0; i < jobs; i++) {
+        check(pthread_create(&r->workers[i].thread, NULL, ring_worker, &r->workers[i]) == 0, "Error starting a decoding thread.");
+        r->started++;
+    }
+
+    return 0;
+
+error:
+    // Leave the ring (and the workers started) to be stopped on close:
+    if (r == NULL) free(chunks);
+    return -1;
+}
+
+// Stop the reader (which may be blocked on the pipe, if the input wasn't
+// read to the end), or the workers, and free the ring:
+static void ring_stop(FC_input *in)
+{
+    FC_ring *r = in->ring;
+    int i = 0;
+
+    if (r->workers) {
+        for (i = 0; i < r->started; i++) {
+            pthread_cancel(r->workers[i].thread);
+        }
+        for (i = 0; i < r->started; i++) {
+            pthread_join(r->workers[i].thread, NULL);
+        }
+    }
+    else {
+        pthread_cancel(r->reader);
+        pthread_join(r->reader, NULL);
+    }
+
+    ring_destroy(r);
+    in->ring = NULL;
+}
+
+// Try to map a regular file whose first DONE bytes (only) have been read
+// from its descriptor, returning 0 if it was mapped.  A file read further
+// than that (say, a standard input that had a header line read off it) is
+// left to be read on from where it is:
+static int input_map(FC_input *in, off_t done)
+{
+    struct stat st;
+    void *map = NULL;
+
+    if (fstat(in->fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+        return -1;
+    }
+
+    if (lseek(in->fd, 0, SEEK_CUR) != done) {
+        errno = 0;
+        return -1;
+    }
+
+    if ((unsigned long long)st.st_size > (size_t)-1) return -1;
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, in->fd, 0);
+    if (map == MAP_FAILED) {
+        debug("mmap failed, streaming instead: %s", clean_errno());
+        errno = 0;
+        return -1;
+    }
+
+    // We read the file once, front to back:
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise(map, st.st_size, MADV_HUGEPAGE);
+#endif
+
+    in->mapped = 1;
+    in->data = map;
+    in->size = st.st_size;
+
+    return 0;
+}
+
+// Allocate (or grow) the read buffer, keeping its first KEEP bytes:
+static int input_grow(FC_input *in, size_t size, size_t keep)
+{
+    long pagesize = sysconf(_SC_PAGESIZE);
+    void *buf = NULL;
+
+    if (pagesize <= 0) pagesize = 4096;
+    size = (size + pagesize - 1) / pagesize * pagesize;
+
+    check(posix_memalign(&buf, pagesize, size) == 0, "Out of memory.");
+
+    if (keep > 0) {
+        memcpy(buf, in->data, keep);
+    }
+
+    free(in->data);
+    in->data = buf;
+    in->size = size;
+
+    return 0;
+
+error:
+    return -1;
+}
+
+// Is IN a pipe (or anything but a regular file)?
+static int input_piped(FC_input *in)
+{
+    struct stat st;
+
+    return fstat(in->fd, &st) == 0 && !S_ISREG(st.st_mode);
+}
+
+// Open FILENAME ("-" is the standard input) for input in blocks of
+// BLOCKSIZE bytes:
+int FC_input_open(FC_input *in, const char *filename, size_t blocksize)
+{
+    return FC_input_open_jobs(in, filename, blocksize, 1);
+}
+
+// Open FILENAME as FC_input_open() does, but decode it on up to JOBS
+// threads if it's a compressed file that can be cut into chunks:
+int FC_input_open_jobs(FC_input *in, const char *filename, size_t blocksize, int jobs)
+{
+    int format = FC_DECODE_NONE;
+    FC_chunk *chunks = NULL;
+    size_t nchunks = 0;
+
+    assert(in != NULL && filename != NULL && blocksize > 0 && jobs > 0);
+
+    in->fd = -1;
+    in->mapped = 0;
+    in->data = NULL;
+    in->size = 0;
+    in->blocksize = blocksize;
+    in->pos = 0;
+    in->eof = 0;
+    in->first = NULL;
+    in->ready = 0;
+    in->ring = NULL;
+
+    if (filename[0] == '-') {
+        in->fd = STDIN_FILENO;
+    }
+    else {
+        in->fd = open(filename, O_RDONLY);
+    }
+
+    // Leave errno (and the message) to the caller:
+    if (in->fd < 0) return -1;
+
+    if (input_map(in, 0) == 0) {
+        // A compressed file is decoded from its mapping (on several threads,
+        // if it can be cut into chunks):
+        format = FC_decode_format(in->data, in->size);
+
+        if (format != FC_DECODE_NONE && jobs > 1) {
+            if (FC_decode_chunks(format, in->data, in->size, blocksize, &chunks, &nchunks) == 0 && nchunks > 1) {
+                if ((size_t)jobs > nchunks) jobs = nchunks;
+                check(ring_start_chunks(in, format, chunks, nchunks, jobs) == 0, "Error allocating input buffers.");
+                return 0;
+            }
+            free(chunks);
+        }
+
+        if (format != FC_DECODE_NONE) {
+            check(ring_start(in, format, NULL, 0) == 0, "Error allocating input buffers.");
+        }
+    }
+    else if (input_piped(in)) {
+        check(ring_start(in, FC_DECODE_NONE, NULL, 0) == 0, "Error allocating input buffers.");
+    }
+    else if (spare_get(in, blocksize) != 0) {
+        check(input_grow(in, blocksize, 0) == 0, "Error allocating input buffer.");
+    }
+
+    return 0;
+
+error:
+    FC_input_close(in);
+    return -1;
+}
+
+// Make IN an input of BLOCKSIZE blocks from the open file FD, whose first
+// LEN bytes have already been read into FIRST.  That block isn't copied,
+// and stays the caller's, so it must be kept until IN is closed.  A file
+// of more than a block is mapped after all, if it can be, the read having
+// only started it into the page cache.  On error IN is left to be closed:
+int FC_input_attach(FC_input *in, int fd, const char *first, size_t len, size_t blocksize)
+{
+    int format = FC_decode_format(first, len);
+
+    assert(in != NULL && fd >= 0 && first != NULL && len <= blocksize);
+
+    in->fd = fd;
+    in->mapped = 0;
+    in->data = NULL;
+    in->size = 0;
+    in->blocksize = blocksize;
+    in->pos = 0;
+    in->eof = 0;
+    in->first = NULL;
+    in->ready = 0;
+    in->ring = NULL;
+
+    // A compressed file is decoded from its mapping, if it can be mapped,
+    // or else from the block read and what follows it:
+    if (format != FC_DECODE_NONE) {
+        input_map(in, len);
+        check(ring_start(in, format, first, len) == 0, "Error allocating input buffers.");
+        return 0;
+    }
+
+    if (len == blocksize && input_map(in, len) == 0) {
+        return 0;
+    }
+
+    in->first = first;
+    in->ready = len;
+
+    return 0;
+
+error:
+    return -1;
+}
+
+// Take the next block read ahead from a pipe, after the KEEP bytes carried
+// over from the last one (see FC_input_next):
+static ssize_t ring_next(FC_input *in, const char **block, size_t keep)
+{
+    FC_ring *r = in->ring;
+    const char *carry = r->last + r->last_len - keep;
+    FC_slot *slot = NULL;
+    char *start = NULL;
+    int joined = 0;
+
+    assert(keep <= r->last_len);
+
+    if (r->done) {
+        *block = carry;
+        r->last = carry;
+        r->last_len = keep;
+        return keep;
+    }
+
+    slot = &r->slots[r->tail % r->nslots];
+    sem_wait_intr(&slot->full);
+    r->tail++;
+    r->done = slot->eof;
+
+    errno = slot->error;
+    check(slot->error == 0, "Error reading input.");
+    check(!slot->corrupt, "Error decompressing input.");
+
+    if (keep <= r->room) {
+        start = slot->buf + r->room - keep;
+        if (keep > 0) memcpy(start, carry, keep);
+    }
+    else {
+        // Too much to carry over into the head room, so join it and the
+        // block in the read buffer (where it may already be):
+        if (r->joined) memmove(in->data, carry, keep);
+
+        if (in->size < keep + slot->len) {
+            size_t size = keep + slot->len;
+            if (size < 2 * in->size) size = 2 * in->size;
+            check(input_grow(in, size, r->joined ? keep : 0) == 0, "Error growing input buffer.");
+        }
+
+        if (!r->joined) memcpy(in->data, carry, keep);
+        memcpy(in->data + keep, slot->buf + r->room, slot->len);
+        start = in->data;
+        joined = 1;
+    }
+
+    *block = start;
+    r->last = start;
+    r->last_len = keep + slot->len;
+    in->pos = r->last_len;
+
+    // Now the last block (and this one, if it was joined) may go back to
+    // the reader:
+    if (r->held) sem_post(&r->free);
+    if (joined) sem_post(&r->free);
+    r->held = !joined;
+    r->joined = joined;
+
+    return r->last_len;
+
+error:
+    return -1;
+}
+
+// Point *BLOCK at the next block of input, which starts with the last KEEP
+// bytes of the previous one, and return its length (-1 on a read error):
+ssize_t FC_input_next(FC_input *in, const char **block, size_t keep)
+{
+    size_t len = 0;
+    ssize_t n = 0;
+
+    assert(in != NULL && block != NULL && keep <= in->pos);
+
+    if (in->mapped) {
+        len = in->size - in->pos;
+        if (len > in->blocksize) len = in->blocksize;
+
+        *block = in->data + in->pos - keep;
+        in->pos += len;
+
+        return keep + len;
+    }
+
+    if (in->ring) {
+        return ring_next(in, block, keep);
+    }
+
+    // The first block may have been read ahead:
+    if (in->ready > 0) {
+        *block = in->first;
+        in->pos = in->ready;
+        in->ready = 0;
+        return in->pos;
+    }
+
+    // Move the carried-over bytes to the front (of a buffer of our own, if
+    // the last block was read ahead), and make room for a full block of new
+    // input after them (growing geometrically, like getline):
+    if (in->first != NULL) {
+        if (spare_get(in, keep + in->blocksize) != 0) {
+            check(input_grow(in, keep + in->blocksize, 0) == 0, "Error allocating input buffer.");
+        }
+        memcpy(in->data, in->first + in->pos - keep, keep);
+        in->first = NULL;
+    }
+    else if (keep > 0) {
+        memmove(in->data, in->data + in->pos - keep, keep);
+    }
+
+    if (in->size - keep < in->blocksize) {
+        size_t size = keep + in->blocksize;
+        if (size < 2 * in->size) size = 2 * in->size;
+        check(input_grow(in, size, keep) == 0, "Error growing input buffer.");
+    }
+
+    // Fill the block, since pipes hand data over a few pages at a time:
+    len = keep;
+    while (len < in->size && !in->eof) {
+        n = read(in->fd, in->data + len, in->size - len);
+
+        if (n < 0 && errno == EINTR) continue;
+        check(n >= 0, "Error reading input.");
+
+        if (n == 0) in->eof = 1;
+        len += n;
+    }
+
+    *block = in->data;
+    in->pos = len;
+
+    return len;
+
+error:
+    return -1;
+}
+
+void FC_input_close(FC_input *in)
+{
+    assert(in != NULL);
+
+    // A mapping is read without moving the file position, so leave the
+    // standard input at its end, as reading it would have (for whatever
+    // reads it next):
+    if (in->fd == STDIN_FILENO && (in->mapped || (in->ring && in->ring->map))) {
+        lseek(in->fd, 0, SEEK_END);
+    }
+
+    if (in->ring) {
+        ring_stop(in);
+    }
+
+    if (in->mapped) {
+        munmap(in->data, in->size);
+    }
+    else if (in->data != NULL) {
+        spare_put(in->data, in->size);
+    }
+
+    if (in->fd > STDIN_FILENO) {
+        close(in->fd);
+    }
+
+    in->fd = -1;
+    in->mapped = 0;
+    in->data = NULL;
+    in->size = 0;
+    in->pos = 0;
+    in->eof = 0;
+    in->first = NULL;
+    in->ready = 0;
+}
@@ -0,0 +1,48 @@
+#ifndef _FC_input_h
+#define _FC_input_h
+
+#include <sys/types.h>
+
+// The default size of an input block:
+#define FC_INPUT_BUFSIZE (1024 * 1024)
+
+// The number of blocks a pipe is read ahead into:
+#define FC_INPUT_RING 4
+
+// The most blocks of memory an input takes: the ring, the compressed input
+// read from a pipe, and a read buffer grown to twice a block (to carry a
+// partial record over).  Decoding on JOBS threads takes 2 * JOBS blocks
+// and the read buffer, which is within JOBS times as many:
+#define FC_INPUT_MAX_BLOCKS (FC_INPUT_RING + 3)
+
+struct FC_ring;
+
+// A source of input blocks.  Regular files are mapped into memory and
+// scanned in place; anything else is read into a page-aligned buffer.
+// A pipe (or compressed input) is read ahead by a thread of its own.
+// Either way the caller may carry the tail of one block over to the start
+// of the next (e.g. a partial record):
+typedef struct FC_input {
+    int fd;
+    int mapped;         // is the file mapped into memory?
+    char *data;         // the mapping, or the read buffer
+    size_t size;        // length of the mapping, or capacity of the buffer
+    size_t blocksize;   // bytes of new input per block
+    size_t pos;         // end of the current block within data
+    int eof;            // has the end of the input been reached?
+    const char *first;  // the first block, if it was read ahead (see FC_input_attach)
+    size_t ready;       // ...and its length, until it is handed out
+    struct FC_ring *ring; // the blocks read ahead from a pipe, or NULL
+} FC_input;
+
+int FC_input_open(FC_input *in, const char *filename, size_t blocksize);
+
+int FC_input_open_jobs(FC_input *in, const char *filename, size_t blocksize, int jobs);
+
+int FC_input_attach(FC_input *in, int fd, const char *first, size_t len, size_t blocksize);
+
+ssize_t FC_input_next(FC_input *in, const char **block, size_t keep);
+
+void FC_input_close(FC_input *in);
+
+#endif
@@ -0,0 +1,423 @@
+// -------------------------------------------------------------------------
+// Compound (multi-byte) delimiter scanning kernels.
+//
+// Every kernel walks a block 64 bytes at a time, like those in fc_scan.c,
+// but the delimiter mask of a chunk is built from candidates: the bytes
+// that equal the first byte of the delimiter, and whose byte DLEN-1
+// further on equals its last byte (two compares, the second on a load
+// that far ahead), and likewise its second and third bytes.  Only the
+// bytes in between (of a delimiter longer than four) are left to verify,
+// a candidate at a time, and any candidate that would overlap the match
+// before it is dropped, which finds the delimiters exactly where strstr()
+// would in each line, since a match can only hold a newline as its last
+// byte.  A short delimiter needs neither step as long as no two of its
+// candidates are close enough to overlap (which they never are if it has
+// no prefix that is also a suffix, like "|~"), and its candidates are its
+// matches then.  The matches are counted against the newlines with
+// popcount, as in fc_scan.c.
+//
+// A match is only verified once all of its bytes are in the block, so the
+// last bytes of a block that may yet start one (fewer than DLEN, and none
+// of them a newline) are left for the caller to carry over to the start of
+// the next block, where they are looked at again.
+//
+// The kernel used is the one bound by the current engine (fc_engine.c).
+// -------------------------------------------------------------------------
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include "util/dbg.h"
+#include "util/fc_hist.h"
+#include "util/fc_match.h"
+#include "util/fc_engine.h"
+
+#ifdef FC_X86
+#include <immintrin.h>
+#endif
+
+// The bytes of the delimiter the vector kernels compare: the first three,
+// and the last:
+#define MATCH_COMPARED 3
+
+// Does the delimiter start at P, whose bytes before FROM (and last byte)
+// match already?
+static inline __attribute__((always_inline))
+int match_verify(const FC_match *m, const unsigned char *p, size_t from)
+{
+    size_t k = 0;
+
+    if (m->never) return 0;
+
+    for (k = from; k + 1 < m->dlen; k++) {
+        if (p[k] != m->delim[k]) return 0;
+    }
+
+    return 1;
+}
+
+// End the open record, whose newline is just before byte offset END:
+static inline __attribute__((always_inline))
+int match_record(FC_match *m, unsigned long long end, FC_hist *hist)
+{
+    int rc = 0;
+
+    if (m->report) {
+        m->line++;
+        if (m->dc + 1 != m->expect) {
+            rc = m->report(m->data, m->line, m->start, m->dc + 1);
+        }
+        m->start = end;
+    }
+    else {
+        check(FC_hist_add(hist, m->dc + 1) == 0, "Error counting record.");
+    }
+
+    m->dc = 0;
+
+    return rc;
+
+error:
+    return -1;
+}
+
+// Record every record terminated within a chunk at byte offset BASE, given
+// the masks of its delimiter matches (d) and newlines (n):
+static inline __attribute__((always_inline))
+int match_masks(FC_match *m, uint64_t d, uint64_t n, unsigned long long base, FC_hist *hist)
+{
+    int rc = 0;
+
+    while (n) {
+        uint64_t upto = n ^ (n - 1);    // bits up to and including the newline
+
+        m->dc += __builtin_popcountll(d & upto);
+        if ((rc = match_record(m, base + __builtin_ctzll(n) + 1, hist)) != 0) return rc;
+
+        d &= ~upto;
+        n &= n - 1;
+    }
+
+    m->dc += __builtin_popcountll(d);
+
+    return 0;
+}
+
+// Drop the candidates of the chunk at offset I that overlap the last match:
+static inline __attribute__((always_inline))
+uint64_t match_after(const FC_match *m, size_t i, uint64_t cand)
+{
+    if (m->next <= i) return cand;
+    if (m->next - i >= 64) return 0;
+
+    return cand & (~0ULL << (m->next - i));
+}
+
+// The matches among the candidates of the chunk at offset I:
+static inline __attribute__((always_inline))
+uint64_t match_resolve(FC_match *m, const unsigned char *p, size_t i, uint64_t cand)
+{
+    uint64_t d = 0;
+
+    cand = match_after(m, i, cand);
+    if (cand == 0) return 0;
+
+    // When the compares cover the whole delimiter, and no two candidates
+    // are close enough to overlap, the candidates are the matches:
+    if (m->exact) {
+        uint64_t near = 0;
+        size_t k = 0;
+
+        if (!m->simple) {
+            for (k = 1; k < m->dlen; k++) near |= cand << k;
+        }
+
+        if ((cand & near) == 0) {
+            m->next = i + (63 - __builtin_clzll(cand)) + m->dlen;
+            return cand;
+        }
+    }
+
+    while (cand) {
+        int b = __builtin_ctzll(cand);
+
+        cand &= cand - 1;
+        if (match_verify(m, p + i + b, MATCH_COMPARED)) {
+            d |= 1ULL << b;
+            m->next = i + b + m->dlen;
+            cand = match_after(m, i, cand);
+        }
+    }
+
+    return d;
+}
+
+// A byte at a time, from offset I of the block:
+static inline __attribute__((always_inline))
+int match_scalar(FC_match *m, const unsigned char *p, size_t i, size_t len, FC_hist *hist)
+{
+    const unsigned char first = m->delim[0];
+    const unsigned char last = m->delim[m->dlen - 1];
+    const size_t limit = (len >= m->dlen) ? len - m->dlen + 1 : 0;
+    int rc = 0;
+
+    for (; i < len; i++) {
+        if (i >= m->next && i < limit
+            && p[i] == first
+            && p[i + m->dlen - 1] == last
+            && match_verify(m, p + i, 1)) {
+            m->dc++;
+            m->next = i + m->dlen;
+        }
+
+        if (p[i] == '\n') {
+            if ((rc = match_record(m, m->pos + i + 1, hist)) != 0) return rc;
+        }
+    }
+
+    return 0;
+}
+
+int FC_match_scalar(FC_match *m, const unsigned char *p, size_t len, FC_hist *hist)
+{
+    return match_scalar(m, p, 0, len, hist);
+}
+
+#ifdef FC_X86
+
+// The mask of the bytes of a 64-byte chunk that equal V:
+static inline __attribute__((always_inline, target("sse2")))
+uint64_t eq_sse(const unsigned char *p, __m128i v)
+{
+    uint64_t mask = 0;
+    int k = 0;
+
+    for (k = 0; k < 4; k++) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(p + 16 * k));
+        __m128i e = _mm_cmpeq_epi8(a, v);
+
+        mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(e) << (16 * k);
+    }
+
+    return mask;
+}
+
+static inline __attribute__((always_inline, target("avx2")))
+uint64_t eq_avx2(const unsigned char *p, __m256i v)
+{
+    __m256i a = _mm256_loadu_si256((const __m256i *)p);
+    __m256i b = _mm256_loadu_si256((const __m256i *)(p + 32));
+
+    return (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, v))
+         | (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b, v)) << 32;
+}
+
+static inline __attribute__((always_inline, target("avx512f,avx512bw")))
+uint64_t eq_avx512(const unsigned char *p, __m512i v)
+{
+    __m512i a = _mm512_loadu_si512((const void *)p);
+
+    return _mm512_cmpeq_epi8_mask(a, v);
+}
+
+// The SSE kernels share one body, built once for plain SSE2 (software
+// popcount) and once with SSE4.2 and the POPCNT instruction:
+static inline __attribute__((always_inline))
+int match_sse(FC_match *m, const unsigned char *p, size_t len, FC_hist *hist)
+{
+    const size_t ahead = m->dlen - 1;
+    const __m128i vf = _mm_set1_epi8((char)m->delim[0]);
+    const __m128i vl = _mm_set1_epi8((char)m->delim[ahead]);
+    const __m128i v1 = _mm_set1_epi8((char)m->delim[1]);
+    const __m128i v2 = _mm_set1_epi8((char)m->delim[ahead > 2 ? 2 : 1]);
+    const __m128i vn = _mm_set1_epi8('\n');
+    size_t i = 0;
+    int rc = 0;
+
+    for (; i + 64 + ahead <= len; i += 64) {
+        uint64_t cand = eq_sse(p + i, vf) & eq_sse(p + i + ahead, vl);
+        uint64_t d = 0;
+
+        if (ahead > 1) cand &= eq_sse(p + i + 1, v1);
+        if (ahead > 2) cand &= eq_sse(p + i + 2, v2);
+        d = match_resolve(m, p, i, cand);
+
+        if ((rc = match_masks(m, d, eq_sse(p + i, vn), m->pos + i, hist)) != 0) return rc;
+    }
+
+    return match_scalar(m, p, i, len, hist);
+}
+
+__attribute__((target("sse2")))
+int FC_match_sse2(FC_match *m, const unsigned char *p, size_t len, FC_hist *hist)
+{
+    return match_sse(m, p, len, hist);
+}
+
+__attribute__((target("sse4.2,popcnt")))
+int FC_match_sse42(FC_match *m, const unsigned char *p, size_t len, FC_hist *hist)
+{
+    return match_sse(m, p, len, hist);
+}
+
+__attribute__((target("avx2,popcnt")))
+int FC_match_avx2(FC_match *m, const unsigned char *p, size_t len, FC_hist *hist)
+{
+    const size_t ahead = m->dlen - 1;
+    const __m256i vf = _mm256_set1_epi8((char)m->delim[0]);
+    const __m256i vl = _mm256_set1_epi8((char)m->delim[ahead]);
+    const __m256i v1 = _mm256_set1_epi8((char)m->delim[1]);
+    const __m256i v2 = _mm256_set1_epi8((char)m->delim[ahead > 2 ? 2 : 1]);
+    const __m256i vn = _mm256_set1_epi8('\n');
+    size_t i = 0;
+    int rc = 0;
+
+    for (; i + 64 + ahead <= len; i += 64) {
+        uint64_t cand = eq_avx2(p + i, vf) & eq_avx2(p + i + ahead, vl);
+        uint64_t d = 0;
+
+        if (ahead > 1) cand &= eq_avx2(p + i + 1, v1);
+        if (ahead > 2) cand &= eq_avx2(p + i + 2, v2);
+        d = match_resolve(m, p, i, cand);
+
+        if ((rc = match_masks(m, d, eq_avx2(p + i, vn), m->pos + i, hist)) != 0) return rc;
+    }
+
+    return match_scalar(m, p, i, len, hist);
+}
+
+__attribute__((target("avx512f,avx512bw,popcnt")))
+int FC_match_avx512(FC_match *m, const unsigned char *p, size_t len, FC_hist *hist)
+{
+    const size_t ahead = m->dlen - 1;
+    const __m512i vf = _mm512_set1_epi8((char)m->delim[0]);
+    const __m512i vl = _mm512_set1_epi8((char)m->delim[ahead]);
+    const __m512i v1 = _mm512_set1_epi8((char)m->delim[1]);
+    const __m512i v2 = _mm512_set1_epi8((char)m->delim[ahead > 2 ? 2 : 1]);
+    const __m512i vn = _mm512_set1_epi8('\n');
+    size_t i = 0;
+    int rc = 0;
+
+    for (; i + 64 + ahead <= len; i += 64) {
+        uint64_t cand = eq_avx512(p + i, vf) & eq_avx512(p + i + ahead, vl);
+        uint64_t d = 0;
+
+        if (ahead > 1) cand &= eq_avx512(p + i + 1, v1);
+        if (ahead > 2) cand &= eq_avx512(p + i + 2, v2);
+        d = match_resolve(m, p, i, cand);
+
+        if ((rc = match_masks(m, d, eq_avx512(p + i, vn), m->pos + i, hist)) != 0) return rc;
+    }
+
+    return match_scalar(m, p, i, len, hist);
+}
+
+#endif
+
+// Start a scan for DELIM, which must be at least 2 bytes long:
+int FC_match_init(FC_match *m, const char *delim)
+{
+    size_t k = 0;
+
+    assert(m != NULL && delim != NULL);
+    check(strlen(delim) >= 2, "Compound delimiter too short: '%s'", delim);
+
+    m->delim = (const unsigned char *)delim;
+    m->dlen = strlen(delim);
+
+    // A newline ends the line before any such delimiter could:
+    m->never = (memchr(delim, '\n', m->dlen - 1) != NULL);
+
+    // Matches can only overlap if a proper prefix of the delimiter is also
+    // a suffix of it (as in "||" or "~|~"):
+    m->exact = !m->never && m->dlen <= MATCH_COMPARED + 1;
+    m->simple = m->exact;
+    for (k = 1; k < m->dlen && m->simple; k++) {
+        if (memcmp(delim, delim + k, m->dlen - k) == 0) m->simple = 0;
+    }
+
+    m->next = 0;
+    m->dc = 0;
+    m->open = 0;
+    m->kernel = FC_engine_current()->match;
+
+    m->expect = 0;
+    m->line = 0;
+    m->start = 0;
+    m->pos = 0;
+    m->report = NULL;
+    m->data = NULL;
+
+    return 0;
+
+error:
+    return -1;
+}
+
+// Start a validating scan, calling REPORT for every record that doesn't
+// have EXPECT fields:
+int FC_match_expect_init(FC_match *m, const char *delim, unsigned long expect, FC_scan_report report, void *data)
+{
+    if (FC_match_init(m, delim) != 0) return -1;
+
+    m->expect = expect;
+    m->report = report;
+    m->data = data;
+
+    return 0;
+}
+
+// Count the delimiters and records in a block of input (or check them,
+// returning the nonzero value of the report that stopped the scan), and
+// set *KEEP to the number of bytes at its end to carry over to the start
+// of the next block:
+int FC_match_block(FC_match *m, const char *buf, size_t len, size_t *keep, FC_hist *hist)
+{
+    const unsigned char *p = (const unsigned char *)buf;
+    size_t tail = 0;
+    size_t i = 0;
+    int rc = 0;
+
+    assert(m != NULL && keep != NULL && (hist != NULL || m->report != NULL));
+
+    *keep = 0;
+    if (len == 0) return 0;
+
+    m->next = 0;
+    if ((rc = m->kernel(m, p, len, hist)) != 0) return rc;
+
+    // Carry over the last bytes, which may start a match still to be
+    // verified: those past the last match and the last newline, and fewer
+    // than DLEN of them:
+    tail = (len >= m->dlen) ? len - m->dlen + 1 : 0;
+    if (tail < m->next) tail = m->next;
+    for (i = len; i > tail; i--) {
+        if (p[i - 1] == '\n') {
+            tail = i;
+            break;
+        }
+    }
+
+    *keep = len - tail;
+    m->pos += tail;
+    m->open = (p[len - 1] != '\n');
+
+    return 0;
+}
+
+// Flush the last record, which (like getline) counts even when the input
+// does not end with a newline:
+int FC_match_finish(FC_match *m, FC_hist *hist)
+{
+    int rc = 0;
+
+    assert(m != NULL);
+
+    if (m->open) {
+        rc = match_record(m, m->pos, hist);
+    }
+
+    m->dc = 0;
+    m->open = 0;
+
+    return rc;
+}
@@ -0,0 +1,42 @@
+#ifndef _FC_match_h
+#define _FC_match_h
+
+#include <stddef.h>
+#include <util/fc_hist.h>
+#include <util/fc_scan.h>
+
+// The state of a field-count scan with a compound (multi-byte) delimiter.
+// Delimiters are matched the way strstr() finds them in a line, left to
+// right and never overlapping.  A NUL byte is data like any other, as it
+// is with a single-byte delimiter:
+typedef struct FC_match {
+    const unsigned char *delim; // the delimiter (not copied)
+    size_t dlen;                // its length, at least 2
+    int never;                  // does it hold a newline before its end?
+    int exact;                  // do the vector compares cover all of it?
+    int simple;                 // ...and can't two matches overlap?
+    size_t next;                // where in the block the next match may start
+    unsigned long dc;           // delimiters seen so far in the open record
+    int open;                   // does the open record hold any bytes yet?
+    int (*kernel) (struct FC_match *m, const unsigned char *p, size_t len, FC_hist *hist);
+
+    // Validating scans only (see FC_scan):
+    unsigned long expect;
+    unsigned long long line;
+    unsigned long long start;
+    unsigned long long pos;
+    FC_scan_report report;
+    void *data;
+} FC_match;
+
+typedef int (*FC_match_kernel) (FC_match *m, const unsigned char *p, size_t len, FC_hist *hist);
+
+int FC_match_init(FC_match *m, const char *delim);
+
+int FC_match_expect_init(FC_match *m, const char *delim, unsigned long expect, FC_scan_report report, void *data);
+
+int FC_match_block(FC_match *m, const char *buf, size_t len, size_t *keep, FC_hist *hist);
+
+int FC_match_finish(FC_match *m, FC_hist *hist);
+
+#endif
@@ -0,0 +1,382 @@
+// -------------------------------------------------------------------------
+// Multi-threaded counting of a single (memory-mapped) file.
+//
+// The input is split into one byte range per job, and every range boundary
+// is moved forward to just past the next newline, so that each record is
+// counted by exactly one thread.  Every thread counts its range into a
+// private histogram, and these are merged in input order at the end,
+// which gives exactly the result of a serial pass.
+//
+// With FAIL_FAST, all threads stop as soon as any one of them has seen two
+// field counts, since the input is inconsistent whatever the rest holds.
+//
+// CSV can't be split this way, since a newline may be inside a quoted
+// field.  But the byte after a newline can only be read in two states:
+// at the start of a row, or inside a quoted field.  So every thread counts
+// its part both ways, and a serial pass then stitches the parts together,
+// taking for each one the count that starts in the state the previous part
+// really ended in.  Any other state (e.g. with a newline delimiter) has
+// that part recounted serially.
+// -------------------------------------------------------------------------
+#include <pthread.h>
+#include <string.h>
+#include "util/dbg.h"
+#include "util/fc_hist.h"
+#include "util/fc_scan.h"
+#include "util/fc_csv.h"
+#include "util/fc_parallel.h"
+
+// A part of the input, counted on its own thread:
+typedef struct FC_part {
+    const char *data;
+    size_t len;
+    unsigned char delim;
+    size_t blocksize;
+    FC_hist *hist;      // the field counts of this part alone
+    int fail_fast;
+    int *stop;          // shared by all parts: set when one finds two counts
+    int rc;
+} FC_part;
+
+static void *part_count(void *arg)
+{
+    FC_part *part = arg;
+    FC_scan s;
+    size_t i = 0;
+
+    FC_scan_init(&s, part->delim);
+
+    for (i = 0; i < part->len; i += part->blocksize) {
+        size_t n = part->len - i;
+        if (n > part->blocksize) n = part->blocksize;
+
+        check(FC_scan_block(&s, part->data + i, n, part->hist) == 0, "Error counting block.");
+
+        if (part->fail_fast) {
+            if (FC_hist_distinct(part->hist) > 1) {
+                __atomic_store_n(part->stop, 1, __ATOMIC_RELAXED);
+            }
+            if (__atomic_load_n(part->stop, __ATOMIC_RELAXED)) {
+                part->rc = 0;
+                return NULL;
+            }
+        }
+    }
+
+    check(FC_scan_finish(&s, part->hist) == 0, "Error counting record.");
+
+    part->rc = 0;
+    return NULL;
+
+error:
+    part->rc = -1;
+    return NULL;
+}
+
+// The offset of the first record starting at or after POS:
+static size_t resync(const char *data, size_t len, size_t pos)
+{
+    const char *nl = NULL;
+
+    if (pos == 0) return 0;
+    if (pos >= len) return len;
+
+    nl = memchr(data + pos - 1, '\n', len - pos + 1);
+
+    return nl ? (size_t)(nl - data) + 1 : len;
+}
+
+// Count DATA on up to JOBS threads, merging the field counts into HIST:
+int FC_parallel_scan(const char *data, size_t len, unsigned char delim, int jobs, size_t blocksize, int fail_fast, FC_hist *hist)
+{
+    FC_part *parts = NULL;
+    pthread_t *threads = NULL;
+    int started = 0;
+    int failed = 0;
+    int stop = 0;
+    size_t start = 0;
+    int i = 0;
+
+    if ((size_t)jobs > len / FC_PARALLEL_MIN_PART) jobs = len / FC_PARALLEL_MIN_PART;
+    if (jobs < 1) jobs = 1;
+
+    parts = calloc(jobs, sizeof(FC_part));
+    check_mem(parts);
+    threads = calloc(jobs, sizeof(pthread_t));
+    check_mem(threads);
+
+    for (i = 0; i < jobs; i++) {
+        size_t end = (i == jobs - 1) ? len : resync(data, len, len / jobs * (i + 1));
+        if (end < start) end = start;
+
+        parts[i].data = data + start;
+        parts[i].len = end - start;
+        parts[i].delim = delim;
+        parts[i].blocksize = blocksize;
+        parts[i].fail_fast = fail_fast;
+        parts[i].stop = &stop;
+        parts[i].hist = FC_hist_create();
+        check_mem(parts[i].hist);
+
+        start = end;
+    }
+
+    // The calling thread counts the first part itself:
+    for (i = 1; i < jobs; i++) {
+        check(pthread_create(&threads[i], NULL, part_count, &parts[i]) == 0, "Error creating thread.");
+        started = i;
+    }
+
+    part_count(&parts[0]);
+
+    for (i = 1; i <= started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    started = 0;
+
+    for (i = 0; i < jobs; i++) {
+        if (parts[i].rc != 0) failed = 1;
+        if (!failed) {
+            check(FC_hist_merge(hist, parts[i].hist) == 0, "Error merging field counts.");
+        }
+    }
+
+    check(!failed, "Error counting input.");
+
+    for (i = 0; i < jobs; i++) {
+        FC_hist_destroy(parts[i].hist);
+    }
+    free(parts);
+    free(threads);
+
+    return 0;
+
+error:
+    for (i = 1; i <= started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    if (parts) {
+        for (i = 0; i < jobs; i++) {
+            if (parts[i].hist) FC_hist_destroy(parts[i].hist);
+        }
+    }
+    free(parts);
+    free(threads);
+    return -1;
+}
+
+// A part of a CSV input, counted on its own thread in both states its first
+// byte may be read in:
+typedef struct FC_csv_part {
+    const char *data;
+    size_t len;
+    size_t blocksize;
+    FC_csv out;             // counted from the start of a row
+    FC_hist *out_hist;
+    FC_csv in;              // counted from inside a quoted field...
+    FC_hist *in_hist;       // ...but for the row open at the start,
+    unsigned long first;    // whose fields up to its end are held back
+    int first_ended;        // (if it ends in this part at all)
+    int speculate;          // count IN at all? (not for the first part)
+    int rc;
+} FC_csv_part;
+
+// Count the part from inside a quoted field, holding back the count of the
+// row open at its start, since only its tail is in this part:
+static int csv_part_inside(FC_csv_part *part)
+{
+    FC_csv saved;
+    const char *p = part->data;
+    const char *end = part->data + part->len;
+
+    // Find the block where that row ends:
+    while (p < end) {
+        size_t n = end - p;
+        if (n > part->blocksize) n = part->blocksize;
+
+        saved = part->in;
+        check(FC_csv_block(&part->in, p, n, NULL) == 0, "Error counting block.");
+        if (part->in.rows > 0) {
+            part->in = saved;
+            break;
+        }
+        p += n;
+    }
+
+    // ...and then the byte, since a row only ends on a CR or LF:
+    while (p < end && !part->first_ended) {
+        const char *t = p;
+        while (t < end && *t != '\n' && *t != '\r') t++;
+
+        check(FC_csv_block(&part->in, p, t - p, NULL) == 0, "Error counting block.");
+        if (t == end) break;
+
+        part->first = part->in.fields + 1;
+        check(FC_csv_block(&part->in, t, 1, NULL) == 0, "Error counting block.");
+        part->first_ended = part->in.rows > 0;
+        p = t + 1;
+    }
+
+    if (p < end) {
+        check(FC_csv_block(&part->in, p, end - p, part->in_hist) == 0, "Error counting block.");
+    }
+
+    return 0;
+
+error:
+    return -1;
+}
+
+static void *csv_part_count(void *arg)
+{
+    FC_csv_part *part = arg;
+
+    check(FC_csv_block(&part->out, part->data, part->len, part->out_hist) == 0, "Error counting block.");
+
+    if (part->speculate) {
+        check(csv_part_inside(part) == 0, "Error counting block.");
+    }
+
+    part->rc = 0;
+    return NULL;
+
+error:
+    part->rc = -1;
+    return NULL;
+}
+
+// Take the counts of PART that start in the state C ended in, adding them
+// to C (and HIST, if any):
+static int csv_stitch(FC_csv *c, FC_csv_part *part, FC_hist *hist)
+{
+    if (part->len == 0) return 0;
+
+    if (c->state == FC_CSV_ROW_NOT_BEGUN) {
+        if (hist) {
+            check(FC_hist_merge(hist, part->out_hist) == 0, "Error merging field counts.");
+        }
+        c->rows += part->out.rows;
+        c->fields = part->out.fields;
+        c->state = part->out.state;
+    }
+    else if (c->state == FC_CSV_QUOTED && part->speculate) {
+        if (part->first_ended) {
+            if (hist) {
+                check(FC_hist_add(hist, c->fields + part->first) == 0, "Error counting record.");
+                check(FC_hist_merge(hist, part->in_hist) == 0, "Error merging field counts.");
+            }
+            c->rows += part->in.rows;
+            c->fields = part->in.fields;
+        }
+        else {
+            c->fields += part->in.fields;
+        }
+        c->state = part->in.state;
+    }
+    else {
+        debug("CSV part starts in state %d: counting it serially", c->state);
+        check(FC_csv_block(c, part->data, part->len, hist) == 0, "Error counting block.");
+    }
+
+    c->last = part->data[part->len - 1];
+
+    return 0;
+
+error:
+    return -1;
+}
+
+// Count the CSV in DATA on up to JOBS threads, merging the field counts
+// into HIST (if not NULL) and setting *ROWS (likewise) to the rows counted:
+int FC_parallel_csv(const char *data, size_t len, unsigned char delim, unsigned char quote, int jobs, size_t blocksize, FC_hist *hist, unsigned long long *rows)
+{
+    FC_csv_part *parts = NULL;
+    pthread_t *threads = NULL;
+    FC_csv c;
+    int started = 0;
+    int failed = 0;
+    size_t start = 0;
+    int i = 0;
+
+    if ((size_t)jobs > len / FC_PARALLEL_MIN_PART) jobs = len / FC_PARALLEL_MIN_PART;
+    if (jobs < 1) jobs = 1;
+
+    parts = calloc(jobs, sizeof(FC_csv_part));
+    check_mem(parts);
+    threads = calloc(jobs, sizeof(pthread_t));
+    check_mem(threads);
+
+    FC_csv_init(&c, delim, quote);
+
+    for (i = 0; i < jobs; i++) {
+        size_t end = (i == jobs - 1) ? len : resync(data, len, len / jobs * (i + 1));
+        if (end < start) end = start;
+
+        parts[i].data = data + start;
+        parts[i].len = end - start;
+        parts[i].blocksize = blocksize;
+        parts[i].speculate = (i > 0);
+
+        parts[i].out = c;
+        parts[i].out.last = '\n';
+        parts[i].in = c;
+        parts[i].in.state = FC_CSV_QUOTED;
+        parts[i].in.last = '\n';
+
+        if (hist) {
+            parts[i].out_hist = FC_hist_create();
+            check_mem(parts[i].out_hist);
+            parts[i].in_hist = FC_hist_create();
+            check_mem(parts[i].in_hist);
+        }
+
+        start = end;
+    }
+
+    for (i = 1; i < jobs; i++) {
+        check(pthread_create(&threads[i], NULL, csv_part_count, &parts[i]) == 0, "Error creating thread.");
+        started = i;
+    }
+
+    csv_part_count(&parts[0]);
+
+    for (i = 1; i <= started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    started = 0;
+
+    for (i = 0; i < jobs; i++) {
+        if (parts[i].rc != 0) failed = 1;
+        if (!failed) {
+            check(csv_stitch(&c, &parts[i], hist) == 0, "Error counting input.");
+        }
+    }
+
+    check(!failed, "Error counting input.");
+    check(FC_csv_finish(&c, hist) == 0, "Error counting record.");
+
+    if (rows) *rows = c.rows;
+
+    for (i = 0; i < jobs; i++) {
+        if (parts[i].out_hist) FC_hist_destroy(parts[i].out_hist);
+        if (parts[i].in_hist) FC_hist_destroy(parts[i].in_hist);
+    }
+    free(parts);
+    free(threads);
+
+    return 0;
+
+error:
+    for (i = 1; i <= started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    if (parts) {
+        for (i = 0; i < jobs; i++) {
+            if (parts[i].out_hist) FC_hist_destroy(parts[i].out_hist);
+            if (parts[i].in_hist) FC_hist_destroy(parts[i].in_hist);
+        }
+    }
+    free(parts);
+    free(threads);
+    return -1;
+}
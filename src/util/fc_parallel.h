@@ -0,0 +1,14 @@
+#ifndef _FC_parallel_h
+#define _FC_parallel_h
+
+#include <stddef.h>
+#include <util/fc_hist.h>
+
+// Don't split the input into parts smaller than this:
+#define FC_PARALLEL_MIN_PART (1024 * 1024)
+
+int FC_parallel_scan(const char *data, size_t len, unsigned char delim, int jobs, size_t blocksize, int fail_fast, FC_hist *hist);
+
+int FC_parallel_csv(const char *data, size_t len, unsigned char delim, unsigned char quote, int jobs, size_t blocksize, FC_hist *hist, unsigned long long *rows);
+
+#endif
@@ -0,0 +1,161 @@
+// -------------------------------------------------------------------------
+// A pool of worker threads for independent items (e.g. input files).
+//
+// Every item's output is captured in memory while it is being worked on,
+// and the calling thread writes the captured outputs to the destination
+// either in item order, or in the order the items are completed.  After an
+// item fails, no new items are started, and nothing after the failed item
+// is written.
+// -------------------------------------------------------------------------
+#include <pthread.h>
+#include <stdlib.h>
+#include "util/dbg.h"
+#include "util/fc_pool.h"
+
+typedef struct FC_pool {
+    int items;
+    int next;           // the next item to start
+    int abort;          // set once an item has failed
+    FC_pool_work work;
+    void *data;
+
+    char **out;         // the captured output of each item
+    size_t *outlen;
+    int *status;
+    int *done;
+    int *finished;      // the items, in the order they were completed
+    int nfinished;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} FC_pool;
+
+static void *pool_worker(void *arg)
+{
+    FC_pool *pool = arg;
+
+    while (1) {
+        char *buf = NULL;
+        size_t len = 0;
+        FILE *out = NULL;
+        int status = -1;
+        int i = 0;
+
+        pthread_mutex_lock(&pool->lock);
+        if (pool->abort || pool->next >= pool->items) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        i = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+
+        out = open_memstream(&buf, &len);
+        if (out != NULL) {
+            status = pool->work(i, out, pool->data);
+            fclose(out);
+        }
+        else {
+            log_err("Error capturing output.");
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        pool->out[i] = buf;
+        pool->outlen[i] = len;
+        pool->status[i] = status;
+        pool->done[i] = 1;
+        pool->finished[pool->nfinished++] = i;
+        if (status < 0) pool->abort = 1;
+        pthread_cond_signal(&pool->cond);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return NULL;
+}
+
+// Work through ITEMS items on WORKERS threads, writing their outputs to
+// DEST.  Returns -1 if an item failed, or else the highest item status:
+int FC_pool_run(int items, int workers, int ordered, FC_pool_work work, void *data, FILE *dest)
+{
+    FC_pool pool = { 0 };
+    pthread_t *threads = NULL;
+    int started = 0;
+    int emitted = 0;
+    int rc = 0;
+    int i = 0;
+
+    pool.items = items;
+    pool.work = work;
+    pool.data = data;
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.cond, NULL);
+
+    if (workers > items) workers = items;
+
+    pool.out = calloc(items, sizeof(char *));
+    pool.outlen = calloc(items, sizeof(size_t));
+    pool.status = calloc(items, sizeof(int));
+    pool.done = calloc(items, sizeof(int));
+    pool.finished = calloc(items, sizeof(int));
+    threads = calloc(workers, sizeof(pthread_t));
+    check_mem(pool.out && pool.outlen && pool.status && pool.done && pool.finished && threads);
+
+    for (started = 0; started < workers; started++) {
+        if (pthread_create(&threads[started], NULL, pool_worker, &pool) != 0) break;
+    }
+    check(started > 0, "Error creating thread.");
+
+    pthread_mutex_lock(&pool.lock);
+
+    while (emitted < items) {
+        if (ordered) {
+            if (!pool.done[emitted]) {
+                pthread_cond_wait(&pool.cond, &pool.lock);
+                continue;
+            }
+            i = emitted;
+        }
+        else {
+            if (emitted >= pool.nfinished) {
+                pthread_cond_wait(&pool.cond, &pool.lock);
+                continue;
+            }
+            i = pool.finished[emitted];
+        }
+
+        if (pool.status[i] < 0) {
+            rc = -1;
+            break;
+        }
+        if (pool.status[i] > rc) rc = pool.status[i];
+
+        pthread_mutex_unlock(&pool.lock);
+        fwrite(pool.out[i], 1, pool.outlen[i], dest);
+        free(pool.out[i]);
+        pool.out[i] = NULL;
+        pthread_mutex_lock(&pool.lock);
+
+        emitted++;
+    }
+
+    pool.abort = 1;
+    pthread_mutex_unlock(&pool.lock);
+
+error:
+    for (i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    if (pool.out) {
+        for (i = 0; i < items; i++) free(pool.out[i]);
+    }
+    free(pool.out);
+    free(pool.outlen);
+    free(pool.status);
+    free(pool.done);
+    free(pool.finished);
+    free(threads);
+    pthread_cond_destroy(&pool.cond);
+    pthread_mutex_destroy(&pool.lock);
+
+    return (started > 0) ? rc : -1;
+}
@@ -0,0 +1,12 @@
+#ifndef _FC_pool_h
+#define _FC_pool_h
+
+#include <stdio.h>
+
+// The work for one item: write its output to OUT, and return a status that
+// is >= 0 on success, or -1 on error:
+typedef int (*FC_pool_work) (int item, FILE *out, void *data);
+
+int FC_pool_run(int items, int workers, int ordered, FC_pool_work work, void *data, FILE *dest);
+
+#endif
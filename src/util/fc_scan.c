@@ -0,0 +1,504 @@
+// -------------------------------------------------------------------------
+// Field-count scanning kernels.
+//
+// Every kernel walks a block of input 64 bytes at a time, builds a bitmask
+// of the delimiter bytes and another of the newline bytes in that chunk
+// (compare + movemask), and then pops one record per newline bit, counting
+// the delimiters in front of it with popcount.  The number of delimiters in
+// the record still open at the end of the block is carried in FC_scan.
+//
+// The validating kernels (FC_expect_*) use the same masks, but compare the
+// field count of every record against the one expected instead of adding
+// it to a histogram, and report the line and offset of the records that
+// differ, which may stop the scan.
+//
+// The line-counting kernels (FC_lines_*, for -l) only count newlines, the
+// way wc -l does: each vector compare yields 0 or -1 per byte, which is
+// subtracted into per-byte counters, and those are summed with a SAD
+// every 255 vectors (before a byte counter could overflow).
+//
+// The kernel used is the one bound by the current engine (fc_engine.c).
+// -------------------------------------------------------------------------
+#include <stdint.h>
+#include <string.h>
+#include "util/dbg.h"
+#include "util/fc_hist.h"
+#include "util/fc_scan.h"
+#include "util/fc_engine.h"
+
+#ifdef FC_X86
+#include <immintrin.h>
+#endif
+
+// Record every record terminated within a 64-byte chunk, given the masks of
+// its delimiter (d) and newline (n) bytes.  A delimiter at the position of
+// the newline itself (i.e. a '\n' delimiter) belongs to the ending record:
+static inline __attribute__((always_inline))
+int scan_masks(FC_scan *s, uint64_t d, uint64_t n, FC_hist *hist)
+{
+    while (n) {
+        uint64_t upto = n ^ (n - 1);    // bits up to and including the newline
+
+        s->dc += __builtin_popcountll(d & upto);
+        check(FC_hist_add(hist, s->dc + 1) == 0, "Error counting record.");
+        s->dc = 0;
+
+        d &= ~upto;
+        n &= n - 1;
+    }
+
+    s->dc += __builtin_popcountll(d);
+
+    return 0;
+
+error:
+    return -1;
+}
+
+int FC_scan_scalar(FC_scan *s, const unsigned char *p, size_t len, FC_hist *hist)
+{
+    const unsigned char *end = p + len;
+    const unsigned char delim = s->delim;
+    unsigned long dc = s->dc;
+
+    for (; p < end; p++) {
+        if (*p == delim) dc++;
+        if (*p == '\n') {
+            check(FC_hist_add(hist, dc + 1) == 0, "Error counting record.");
+            dc = 0;
+        }
+    }
+
+    s->dc = dc;
+    return 0;
+
+error:
+    return -1;
+}
+
+// The validating counterpart of scan_masks(), for a chunk at byte offset BASE:
+static inline __attribute__((always_inline))
+int expect_masks(FC_scan *s, uint64_t d, uint64_t n, unsigned long long base)
+{
+    int rc = 0;
+
+    while (n) {
+        uint64_t upto = n ^ (n - 1);
+
+        s->dc += __builtin_popcountll(d & upto);
+        s->line++;
+
+        if (s->dc + 1 != s->expect) {
+            rc = s->report(s->data, s->line, s->start, s->dc + 1);
+        }
+
+        s->start = base + __builtin_ctzll(n) + 1;
+        s->dc = 0;
+        if (rc) return rc;
+
+        d &= ~upto;
+        n &= n - 1;
+    }
+
+    s->dc += __builtin_popcountll(d);
+
+    return 0;
+}
+
+static inline __attribute__((always_inline))
+int expect_scalar(FC_scan *s, const unsigned char *p, size_t len, unsigned long long base)
+{
+    const unsigned char delim = s->delim;
+    size_t i = 0;
+    int rc = 0;
+
+    for (i = 0; i < len; i++) {
+        if (p[i] == delim) s->dc++;
+        if (p[i] == '\n') {
+            s->line++;
+
+            if (s->dc + 1 != s->expect) {
+                rc = s->report(s->data, s->line, s->start, s->dc + 1);
+            }
+
+            s->start = base + i + 1;
+            s->dc = 0;
+            if (rc) return rc;
+        }
+    }
+
+    return 0;
+}
+
+int FC_expect_scalar(FC_scan *s, const unsigned char *p, size_t len)
+{
+    return expect_scalar(s, p, len, s->pos);
+}
+
+unsigned long long FC_lines_scalar(const unsigned char *p, size_t len)
+{
+    const unsigned char *end = p + len;
+    unsigned long long lines = 0;
+
+    while ((p = memchr(p, '\n', end - p)) != NULL) {
+        lines++;
+        p++;
+    }
+
+    return lines;
+}
+
+#ifdef FC_X86
+
+// The delimiter (d) and newline (n) masks of a 64-byte chunk, for each
+// instruction-set level:
+static inline __attribute__((always_inline, target("sse2")))
+void masks_sse(const unsigned char *p, __m128i vd, __m128i vn, uint64_t *d, uint64_t *n)
+{
+    __m128i a = _mm_loadu_si128((const __m128i *)p);
+    __m128i b = _mm_loadu_si128((const __m128i *)(p + 16));
+    __m128i c = _mm_loadu_si128((const __m128i *)(p + 32));
+    __m128i e = _mm_loadu_si128((const __m128i *)(p + 48));
+
+    *d = (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(a, vd))
+       | (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(b, vd)) << 16
+       | (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(c, vd)) << 32
+       | (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(e, vd)) << 48;
+    *n = (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(a, vn))
+       | (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(b, vn)) << 16
+       | (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(c, vn)) << 32
+       | (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(e, vn)) << 48;
+}
+
+static inline __attribute__((always_inline, target("avx2")))
+void masks_avx2(const unsigned char *p, __m256i vd, __m256i vn, uint64_t *d, uint64_t *n)
+{
+    __m256i a = _mm256_loadu_si256((const __m256i *)p);
+    __m256i b = _mm256_loadu_si256((const __m256i *)(p + 32));
+
+    *d = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, vd))
+       | (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b, vd)) << 32;
+    *n = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, vn))
+       | (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b, vn)) << 32;
+}
+
+static inline __attribute__((always_inline, target("avx512f,avx512bw")))
+void masks_avx512(const unsigned char *p, __m512i vd, __m512i vn, uint64_t *d, uint64_t *n)
+{
+    __m512i a = _mm512_loadu_si512((const void *)p);
+
+    *d = _mm512_cmpeq_epi8_mask(a, vd);
+    *n = _mm512_cmpeq_epi8_mask(a, vn);
+}
+
+// The SSE kernels share one body, built once for plain SSE2 (software
+// popcount) and once with SSE4.2 and the POPCNT instruction:
+static inline __attribute__((always_inline))
+int scan_sse(FC_scan *s, const unsigned char *p, size_t len, FC_hist *hist)
+{
+    const __m128i vd = _mm_set1_epi8((char)s->delim);
+    const __m128i vn = _mm_set1_epi8('\n');
+    uint64_t d = 0, n = 0;
+    size_t i = 0;
+
+    for (; i + 64 <= len; i += 64) {
+        masks_sse(p + i, vd, vn, &d, &n);
+        check(scan_masks(s, d, n, hist) == 0, "Error counting block.");
+    }
+
+    return FC_scan_scalar(s, p + i, len - i, hist);
+
+error:
+    return -1;
+}
+
+__attribute__((target("sse2")))
+int FC_scan_sse2(FC_scan *s, const unsigned char *p, size_t len, FC_hist *hist)
+{
+    return scan_sse(s, p, len, hist);
+}
+
+__attribute__((target("sse4.2,popcnt")))
+int FC_scan_sse42(FC_scan *s, const unsigned char *p, size_t len, FC_hist *hist)
+{
+    return scan_sse(s, p, len, hist);
+}
+
+__attribute__((target("avx2,popcnt")))
+int FC_scan_avx2(FC_scan *s, const unsigned char *p, size_t len, FC_hist *hist)
+{
+    const __m256i vd = _mm256_set1_epi8((char)s->delim);
+    const __m256i vn = _mm256_set1_epi8('\n');
+    uint64_t d = 0, n = 0;
+    size_t i = 0;
+
+    for (; i + 64 <= len; i += 64) {
+        masks_avx2(p + i, vd, vn, &d, &n);
+        check(scan_masks(s, d, n, hist) == 0, "Error counting block.");
+    }
+
+    return FC_scan_scalar(s, p + i, len - i, hist);
+
+error:
+    return -1;
+}
+
+__attribute__((target("avx512f,avx512bw,popcnt")))
+int FC_scan_avx512(FC_scan *s, const unsigned char *p, size_t len, FC_hist *hist)
+{
+    const __m512i vd = _mm512_set1_epi8((char)s->delim);
+    const __m512i vn = _mm512_set1_epi8('\n');
+    uint64_t d = 0, n = 0;
+    size_t i = 0;
+
+    for (; i + 64 <= len; i += 64) {
+        masks_avx512(p + i, vd, vn, &d, &n);
+        check(scan_masks(s, d, n, hist) == 0, "Error counting block.");
+    }
+
+    return FC_scan_scalar(s, p + i, len - i, hist);
+
+error:
+    return -1;
+}
+
+static inline __attribute__((always_inline))
+int expect_sse(FC_scan *s, const unsigned char *p, size_t len)
+{
+    const __m128i vd = _mm_set1_epi8((char)s->delim);
+    const __m128i vn = _mm_set1_epi8('\n');
+    uint64_t d = 0, n = 0;
+    size_t i = 0;
+    int rc = 0;
+
+    for (; i + 64 <= len; i += 64) {
+        masks_sse(p + i, vd, vn, &d, &n);
+        if ((rc = expect_masks(s, d, n, s->pos + i)) != 0) return rc;
+    }
+
+    return expect_scalar(s, p + i, len - i, s->pos + i);
+}
+
+__attribute__((target("sse2")))
+int FC_expect_sse2(FC_scan *s, const unsigned char *p, size_t len)
+{
+    return expect_sse(s, p, len);
+}
+
+__attribute__((target("sse4.2,popcnt")))
+int FC_expect_sse42(FC_scan *s, const unsigned char *p, size_t len)
+{
+    return expect_sse(s, p, len);
+}
+
+__attribute__((target("avx2,popcnt")))
+int FC_expect_avx2(FC_scan *s, const unsigned char *p, size_t len)
+{
+    const __m256i vd = _mm256_set1_epi8((char)s->delim);
+    const __m256i vn = _mm256_set1_epi8('\n');
+    uint64_t d = 0, n = 0;
+    size_t i = 0;
+    int rc = 0;
+
+    for (; i + 64 <= len; i += 64) {
+        masks_avx2(p + i, vd, vn, &d, &n);
+        if ((rc = expect_masks(s, d, n, s->pos + i)) != 0) return rc;
+    }
+
+    return expect_scalar(s, p + i, len - i, s->pos + i);
+}
+
+__attribute__((target("avx512f,avx512bw,popcnt")))
+int FC_expect_avx512(FC_scan *s, const unsigned char *p, size_t len)
+{
+    const __m512i vd = _mm512_set1_epi8((char)s->delim);
+    const __m512i vn = _mm512_set1_epi8('\n');
+    uint64_t d = 0, n = 0;
+    size_t i = 0;
+    int rc = 0;
+
+    for (; i + 64 <= len; i += 64) {
+        masks_avx512(p + i, vd, vn, &d, &n);
+        if ((rc = expect_masks(s, d, n, s->pos + i)) != 0) return rc;
+    }
+
+    return expect_scalar(s, p + i, len - i, s->pos + i);
+}
+
+__attribute__((target("sse2")))
+unsigned long long FC_lines_sse2(const unsigned char *p, size_t len)
+{
+    const __m128i vn = _mm_set1_epi8('\n');
+    const __m128i zero = _mm_setzero_si128();
+    __m128i total = zero;
+    uint64_t sums[2];
+    size_t i = 0;
+
+    while (i + 16 <= len) {
+        size_t stop = (len - i > 255 * 16) ? i + 255 * 16 : len;
+        __m128i acc = zero;
+
+        for (; i + 16 <= stop; i += 16) {
+            acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i)), vn));
+        }
+
+        total = _mm_add_epi64(total, _mm_sad_epu8(acc, zero));
+    }
+
+    _mm_storeu_si128((__m128i *)sums, total);
+
+    return sums[0] + sums[1] + FC_lines_scalar(p + i, len - i);
+}
+
+__attribute__((target("avx2")))
+unsigned long long FC_lines_avx2(const unsigned char *p, size_t len)
+{
+    const __m256i vn = _mm256_set1_epi8('\n');
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i total = zero;
+    uint64_t sums[4];
+    size_t i = 0;
+
+    while (i + 32 <= len) {
+        size_t stop = (len - i > 255 * 32) ? i + 255 * 32 : len;
+        __m256i acc = zero;
+
+        for (; i + 32 <= stop; i += 32) {
+            acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + i)), vn));
+        }
+
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(acc, zero));
+    }
+
+    _mm256_storeu_si256((__m256i *)sums, total);
+
+    return sums[0] + sums[1] + sums[2] + sums[3] + FC_lines_scalar(p + i, len - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+unsigned long long FC_lines_avx512(const unsigned char *p, size_t len)
+{
+    const __m512i vn = _mm512_set1_epi8('\n');
+    const __m512i zero = _mm512_setzero_si512();
+    __m512i total = zero;
+    size_t i = 0;
+
+    while (i + 64 <= len) {
+        size_t stop = (len - i > 255 * 64) ? i + 255 * 64 : len;
+        __m512i acc = zero;
+
+        for (; i + 64 <= stop; i += 64) {
+            __m512i a = _mm512_loadu_si512((const void *)(p + i));
+            acc = _mm512_mask_sub_epi8(acc, _mm512_cmpeq_epi8_mask(a, vn), acc, _mm512_set1_epi8(-1));
+        }
+
+        total = _mm512_add_epi64(total, _mm512_sad_epu8(acc, zero));
+    }
+
+    return (unsigned long long)_mm512_reduce_add_epi64(total) + FC_lines_scalar(p + i, len - i);
+}
+
+#endif
+
+void FC_scan_init(FC_scan *s, unsigned char delim)
+{
+    assert(s != NULL);
+
+    s->delim = delim;
+    s->dc = 0;
+    s->open = 0;
+    s->kernel = FC_engine_current()->count;
+}
+
+// Count the delimiters and records in a block of input:
+int FC_scan_block(FC_scan *s, const char *buf, size_t len, FC_hist *hist)
+{
+    assert(s != NULL && hist != NULL);
+
+    if (len == 0) return 0;
+
+    check(s->kernel(s, (const unsigned char *)buf, len, hist) == 0, "Error counting block.");
+    s->open = (buf[len - 1] != '\n');
+
+    return 0;
+
+error:
+    return -1;
+}
+
+// Flush the last record, which (like getline) counts even when the input
+// does not end with a newline:
+int FC_scan_finish(FC_scan *s, FC_hist *hist)
+{
+    assert(s != NULL && hist != NULL);
+
+    if (s->open) {
+        check(FC_hist_add(hist, s->dc + 1) == 0, "Error counting record.");
+    }
+
+    s->dc = 0;
+    s->open = 0;
+
+    return 0;
+
+error:
+    return -1;
+}
+
+// Start a validating scan, calling REPORT for every record that doesn't
+// have EXPECT fields:
+void FC_expect_init(FC_scan *s, unsigned char delim, unsigned long expect, FC_scan_report report, void *data)
+{
+    FC_scan_init(s, delim);
+
+    s->expect = expect;
+    s->line = 0;
+    s->start = 0;
+    s->pos = 0;
+    s->expect_kernel = FC_engine_current()->expect;
+    s->report = report;
+    s->data = data;
+}
+
+// Check the records in a block of input, returning 0, or the nonzero value
+// of the report that stopped the scan:
+int FC_expect_block(FC_scan *s, const char *buf, size_t len)
+{
+    int rc = 0;
+
+    assert(s != NULL && s->report != NULL);
+
+    if (len == 0) return 0;
+
+    rc = s->expect_kernel(s, (const unsigned char *)buf, len);
+    s->pos += len;
+    s->open = (buf[len - 1] != '\n');
+
+    return rc;
+}
+
+// Check the last record, which may have no newline:
+int FC_expect_finish(FC_scan *s)
+{
+    int rc = 0;
+
+    assert(s != NULL && s->report != NULL);
+
+    if (s->open) {
+        s->line++;
+        if (s->dc + 1 != s->expect) {
+            rc = s->report(s->data, s->line, s->start, s->dc + 1);
+        }
+    }
+
+    s->dc = 0;
+    s->open = 0;
+
+    return rc;
+}
+
+// Count the newlines in a block of input:
+unsigned long long FC_scan_lines(const char *buf, size_t len)
+{
+    return FC_engine_current()->lines((const unsigned char *)buf, len);
+}
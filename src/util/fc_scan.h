@@ -0,0 +1,50 @@
+#ifndef _FC_scan_h
+#define _FC_scan_h
+
+#include <stddef.h>
+#include <util/fc_hist.h>
+
+// Called by a validating scan (FC_expect_*) for every record that doesn't
+// have the expected field count, with its line number (from 1) and byte
+// offset (from 0).  A nonzero return stops the scan:
+typedef int (*FC_scan_report) (void *data, unsigned long long line, unsigned long long offset, unsigned long fieldcount);
+
+// The state of a field-count scan, carried from one block of input to the
+// next so that records may straddle block boundaries:
+typedef struct FC_scan {
+    unsigned char delim;    // the (single-byte) delimiter
+    unsigned long dc;       // delimiters seen so far in the open record
+    int open;               // does the open record hold any bytes yet?
+    int (*kernel) (struct FC_scan *s, const unsigned char *p, size_t len, FC_hist *hist);
+
+    // Validating scans only:
+    unsigned long expect;       // the field count every record must have
+    unsigned long long line;    // records ended so far
+    unsigned long long start;   // byte offset of the open record
+    unsigned long long pos;     // byte offset of the next block
+    int (*expect_kernel) (struct FC_scan *s, const unsigned char *p, size_t len);
+    FC_scan_report report;
+    void *data;
+} FC_scan;
+
+typedef int (*FC_scan_kernel) (FC_scan *s, const unsigned char *p, size_t len, FC_hist *hist);
+
+typedef int (*FC_expect_kernel) (FC_scan *s, const unsigned char *p, size_t len);
+
+typedef unsigned long long (*FC_lines_kernel) (const unsigned char *p, size_t len);
+
+void FC_scan_init(FC_scan *s, unsigned char delim);
+
+int FC_scan_block(FC_scan *s, const char *buf, size_t len, FC_hist *hist);
+
+int FC_scan_finish(FC_scan *s, FC_hist *hist);
+
+void FC_expect_init(FC_scan *s, unsigned char delim, unsigned long expect, FC_scan_report report, void *data);
+
+int FC_expect_block(FC_scan *s, const char *buf, size_t len);
+
+int FC_expect_finish(FC_scan *s);
+
+unsigned long long FC_scan_lines(const char *buf, size_t len);
+
+#endif
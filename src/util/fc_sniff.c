@@ -0,0 +1,430 @@
+// -------------------------------------------------------------------------
+// Delimiter sniffing (--sniff).
+//
+// A file of unknown format would otherwise be counted once for each
+// delimiter it might have, plain (-d) and as CSV (-C).  Here every byte is
+// classified once instead: each 64-byte chunk is compared with every byte
+// that matters to any of the candidates (LF, CR, space, tab, the quote and
+// the delimiters themselves), which gives a bitmask per byte, and then
+// every candidate is counted from the masks alone.  Plain candidates count
+// their delimiters against the LFs with popcount, as in fc_scan.c, and CSV
+// candidates are handed the masks of their quotes, delimiters, CR/LFs and
+// blanks by FC_csv_chunk(), which follows the quoting as the CSV kernels
+// do.  Each candidate keeps a histogram of its own.
+//
+// FC_sniff_rank() then orders the candidates by how consistent their field
+// counts are.
+//
+// The kernel used is the one bound by the current engine (fc_engine.c).
+// -------------------------------------------------------------------------
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util/dbg.h"
+#include "util/fc_hist.h"
+#include "util/fc_csv.h"
+#include "util/fc_sniff.h"
+#include "util/fc_engine.h"
+
+#ifdef FC_X86
+#include <immintrin.h>
+#endif
+
+#define is_term(C) ((C) == '\r' || (C) == '\n')
+
+// The class of byte C, which is given one if it has none yet:
+static int sniff_class(FC_sniff *s, unsigned char c)
+{
+    if (s->cls[c] < 0) {
+        s->bytes[s->nbytes] = c;
+        s->cls[c] = s->nbytes++;
+    }
+
+    return s->cls[c];
+}
+
+// Set up to sniff the input for each byte of DELIMS, plain and as CSV with
+// QUOTE:
+FC_sniff *FC_sniff_create(const char *delims, unsigned char quote)
+{
+    FC_sniff *s = NULL;
+    FC_sniff_candidate *c = NULL;
+    size_t i = 0;
+    int j = 0;
+    int csv = 0;
+
+    assert(delims != NULL);
+
+    s = calloc(1, sizeof(FC_sniff));
+    check_mem(s);
+
+    memset(s->cls, -1, sizeof(s->cls));
+    s->quote = quote;
+    s->lf = sniff_class(s, '\n');
+    s->cr = sniff_class(s, '\r');
+    s->space = sniff_class(s, ' ');
+    s->tab = sniff_class(s, '\t');
+    s->q = sniff_class(s, quote);
+    s->kernel = FC_engine_current()->sniff;
+
+    for (i = 0; delims[i] != '\0'; i++) {
+        unsigned char d = delims[i];
+
+        check(!is_term(d), "ERROR: a CR or LF can't be a delimiter");
+
+        for (j = 0; j < s->ncand && s->cand[j].delim != d; j++);
+        if (j < s->ncand) continue;
+
+        check(s->ncand < 2 * FC_SNIFF_DELIMS, "ERROR: at most %d delimiters can be sniffed at once", FC_SNIFF_DELIMS);
+
+        // Plain, and then as CSV:
+        for (csv = 0; csv < 2; csv++) {
+            c = &s->cand[s->ncand++];
+            c->delim = d;
+            c->csv = csv;
+            c->dbit = sniff_class(s, d);
+
+            c->hist = FC_hist_create();
+            check_mem(c->hist);
+
+            if (csv) {
+                c->parser = malloc(sizeof(FC_csv));
+                check_mem(c->parser);
+                FC_csv_init(c->parser, d, quote);
+            }
+        }
+    }
+
+    check(s->ncand > 0, "ERROR: no delimiters to sniff");
+
+    return s;
+
+error:
+    FC_sniff_destroy(s);
+    return NULL;
+}
+
+void FC_sniff_destroy(FC_sniff *s)
+{
+    int i = 0;
+
+    if (s == NULL) return;
+
+    for (i = 0; i < s->ncand; i++) {
+        if (s->cand[i].hist) FC_hist_destroy(s->cand[i].hist);
+        free(s->cand[i].parser);
+    }
+
+    free(s);
+}
+
+// Record every record a plain candidate ends within a chunk, given the
+// masks of its delimiters (d) and newlines (n), as scan_masks() does:
+static inline __attribute__((always_inline))
+int sniff_masks(FC_sniff_candidate *c, uint64_t d, uint64_t n)
+{
+    // Most candidates don't split the input at all, and every record but
+    // the first then has a single field:
+    if (d == 0 && n) {
+        check(FC_hist_add(c->hist, c->dc + 1) == 0, "Error counting record.");
+        check(FC_hist_add_n(c->hist, 1, __builtin_popcountll(n) - 1) == 0, "Error counting record.");
+        c->dc = 0;
+
+        return 0;
+    }
+
+    while (n) {
+        uint64_t upto = n ^ (n - 1);    // bits up to and including the newline
+
+        c->dc += __builtin_popcountll(d & upto);
+        check(FC_hist_add(c->hist, c->dc + 1) == 0, "Error counting record.");
+        c->dc = 0;
+
+        d &= ~upto;
+        n &= n - 1;
+    }
+
+    c->dc += __builtin_popcountll(d);
+
+    return 0;
+
+error:
+    return -1;
+}
+
+// Count LEN bytes at P (a chunk of 64, or the tail of a block) for every
+// candidate, given the masks of its bytes, by class (M):
+static inline __attribute__((always_inline))
+int sniff_chunk(FC_sniff *s, const unsigned char *p, size_t len, const uint64_t *m)
+{
+    uint64_t t = m[s->cr] | m[s->lf];
+    uint64_t b = m[s->space] | m[s->tab];
+    int i = 0;
+
+    for (i = 0; i < s->ncand; i++) {
+        FC_sniff_candidate *c = &s->cand[i];
+
+        if (!c->csv) {
+            check(sniff_masks(c, m[c->dbit], m[s->lf]) == 0, "Error counting block.");
+        }
+        else if (len == 64) {
+            check(FC_csv_chunk(c->parser, p, m[s->q], m[c->dbit], t, b, c->hist) == 0, "Error counting block.");
+        }
+        else {
+            check(FC_csv_block(c->parser, (const char *)p, len, c->hist) == 0, "Error counting block.");
+        }
+    }
+
+    return 0;
+
+error:
+    return -1;
+}
+
+// Classify a byte at a time, which is also how the vector kernels finish a
+// block:
+static inline __attribute__((always_inline))
+int sniff_scalar(FC_sniff *s, const unsigned char *p, size_t len)
+{
+    uint64_t m[FC_SNIFF_BYTES];
+    size_t i = 0;
+    size_t j = 0;
+    size_t n = 0;
+
+    for (i = 0; i < len; i += n) {
+        n = (len - i < 64) ? len - i : 64;
+        memset(m, 0, sizeof(m));
+
+        for (j = 0; j < n; j++) {
+            int k = s->cls[p[i + j]];
+            if (k >= 0) m[k] |= 1ULL << j;
+        }
+
+        check(sniff_chunk(s, p + i, n, m) == 0, "Error counting block.");
+    }
+
+    return 0;
+
+error:
+    return -1;
+}
+
+int FC_sniff_scalar(FC_sniff *s, const unsigned char *p, size_t len)
+{
+    return sniff_scalar(s, p, len);
+}
+
+#ifdef FC_X86
+
+// The SSE kernels share one body, built once for plain SSE2 (software
+// popcount) and once with SSE4.2 and the POPCNT instruction:
+static inline __attribute__((always_inline))
+int sniff_sse(FC_sniff *s, const unsigned char *p, size_t len)
+{
+    __m128i vb[FC_SNIFF_BYTES];
+    uint64_t m[FC_SNIFF_BYTES];
+    size_t i = 0;
+    int k = 0;
+
+    for (k = 0; k < s->nbytes; k++) {
+        vb[k] = _mm_set1_epi8((char)s->bytes[k]);
+    }
+
+    for (; i + 64 <= len; i += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(p + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(p + i + 32));
+        __m128i e = _mm_loadu_si128((const __m128i *)(p + i + 48));
+
+        for (k = 0; k < s->nbytes; k++) {
+            m[k] = (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(a, vb[k]))
+                 | (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(b, vb[k])) << 16
+                 | (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(c, vb[k])) << 32
+                 | (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(e, vb[k])) << 48;
+        }
+
+        check(sniff_chunk(s, p + i, 64, m) == 0, "Error counting block.");
+    }
+
+    return sniff_scalar(s, p + i, len - i);
+
+error:
+    return -1;
+}
+
+__attribute__((target("sse2")))
+int FC_sniff_sse2(FC_sniff *s, const unsigned char *p, size_t len)
+{
+    return sniff_sse(s, p, len);
+}
+
+__attribute__((target("sse4.2,popcnt")))
+int FC_sniff_sse42(FC_sniff *s, const unsigned char *p, size_t len)
+{
+    return sniff_sse(s, p, len);
+}
+
+__attribute__((target("avx2,popcnt")))
+int FC_sniff_avx2(FC_sniff *s, const unsigned char *p, size_t len)
+{
+    __m256i vb[FC_SNIFF_BYTES];
+    uint64_t m[FC_SNIFF_BYTES];
+    size_t i = 0;
+    int k = 0;
+
+    for (k = 0; k < s->nbytes; k++) {
+        vb[k] = _mm256_set1_epi8((char)s->bytes[k]);
+    }
+
+    for (; i + 64 <= len; i += 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(p + i + 32));
+
+        for (k = 0; k < s->nbytes; k++) {
+            m[k] = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, vb[k]))
+                 | (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b, vb[k])) << 32;
+        }
+
+        check(sniff_chunk(s, p + i, 64, m) == 0, "Error counting block.");
+    }
+
+    return sniff_scalar(s, p + i, len - i);
+
+error:
+    return -1;
+}
+
+__attribute__((target("avx512f,avx512bw,popcnt")))
+int FC_sniff_avx512(FC_sniff *s, const unsigned char *p, size_t len)
+{
+    __m512i vb[FC_SNIFF_BYTES];
+    uint64_t m[FC_SNIFF_BYTES];
+    size_t i = 0;
+    int k = 0;
+
+    for (k = 0; k < s->nbytes; k++) {
+        vb[k] = _mm512_set1_epi8((char)s->bytes[k]);
+    }
+
+    for (; i + 64 <= len; i += 64) {
+        __m512i a = _mm512_loadu_si512((const void *)(p + i));
+
+        for (k = 0; k < s->nbytes; k++) {
+            m[k] = _mm512_cmpeq_epi8_mask(a, vb[k]);
+        }
+
+        check(sniff_chunk(s, p + i, 64, m) == 0, "Error counting block.");
+    }
+
+    return sniff_scalar(s, p + i, len - i);
+
+error:
+    return -1;
+}
+
+#endif
+
+// Count a block of input for every candidate:
+int FC_sniff_block(FC_sniff *s, const char *buf, size_t len)
+{
+    assert(s != NULL);
+
+    if (len == 0) return 0;
+
+    check(s->kernel(s, (const unsigned char *)buf, len) == 0, "Error counting block.");
+    s->open = (buf[len - 1] != '\n');
+
+    return 0;
+
+error:
+    return -1;
+}
+
+// End the last record, if the input didn't (as FC_scan_finish() and
+// FC_csv_finish() do):
+int FC_sniff_finish(FC_sniff *s)
+{
+    int i = 0;
+
+    assert(s != NULL);
+
+    for (i = 0; i < s->ncand; i++) {
+        FC_sniff_candidate *c = &s->cand[i];
+
+        if (c->csv) {
+            check(FC_csv_finish(c->parser, c->hist) == 0, "Error counting record.");
+        }
+        else if (s->open) {
+            check(FC_hist_add(c->hist, c->dc + 1) == 0, "Error counting record.");
+        }
+
+        c->dc = 0;
+    }
+
+    s->open = 0;
+
+    return 0;
+
+error:
+    return -1;
+}
+
+// The share of a candidate's records that have its most common field count:
+static double sniff_consistency(const FC_sniff_candidate *c)
+{
+    return c->records ? (double)c->consistent / c->records : 0;
+}
+
+static int sniff_cmp(const void *a, const void *b)
+{
+    const FC_sniff_candidate *x = *(FC_sniff_candidate * const *)a;
+    const FC_sniff_candidate *y = *(FC_sniff_candidate * const *)b;
+    double cx = sniff_consistency(x);
+    double cy = sniff_consistency(y);
+
+    // A delimiter that never splits a record tells nothing:
+    if ((x->fieldcount > 1) != (y->fieldcount > 1)) return (y->fieldcount > 1) - (x->fieldcount > 1);
+    if (cx != cy) return (cx < cy) - (cx > cy);
+    if (x->fieldcount != y->fieldcount) return (x->fieldcount < y->fieldcount) - (x->fieldcount > y->fieldcount);
+
+    // Reading the input as CSV is only worth it if it counts differently:
+    if (x->csv != y->csv) return x->csv - y->csv;
+
+    return (x > y) - (x < y);
+}
+
+// Find the most common field count of every candidate, and put them all in
+// RANKED (which has room for FC_sniff.ncand), best first: those that split
+// records at all, by the share of records that have it, then by how many
+// fields that is.  Returns the number of candidates:
+int FC_sniff_rank(FC_sniff *s, FC_sniff_candidate **ranked)
+{
+    int i = 0;
+    size_t j = 0;
+
+    assert(s != NULL && ranked != NULL);
+
+    for (i = 0; i < s->ncand; i++) {
+        FC_sniff_candidate *c = &s->cand[i];
+
+        c->fieldcount = 0;
+        c->records = 0;
+        c->consistent = 0;
+
+        for (j = 0; j < c->hist->nseen; j++) {
+            unsigned long long n = FC_hist_get(c->hist, c->hist->seen[j]);
+
+            c->records += n;
+            if (n > c->consistent) {
+                c->consistent = n;
+                c->fieldcount = c->hist->seen[j];
+            }
+        }
+
+        ranked[i] = c;
+    }
+
+    qsort(ranked, s->ncand, sizeof(FC_sniff_candidate *), sniff_cmp);
+
+    return s->ncand;
+}
@@ -0,0 +1,61 @@
+#ifndef _FC_sniff_h
+#define _FC_sniff_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <util/fc_hist.h>
+#include <util/fc_csv.h>
+
+// The candidate delimiters tried at once, at most:
+#define FC_SNIFF_DELIMS 8
+
+// ...and the bytes every chunk is classified by: those, a quote, a CR, a
+// LF, a space and a tab:
+#define FC_SNIFF_BYTES (FC_SNIFF_DELIMS + 5)
+
+// The default candidates:
+#define FC_SNIFF_DEFAULT ",\t|;"
+
+// One way of reading the input: a delimiter, plain or as CSV:
+typedef struct FC_sniff_candidate {
+    unsigned char delim;
+    int csv;                    // is the input read as CSV?
+    int dbit;                   // the class of the delimiter
+    unsigned long dc;           // plain: delimiters seen so far in the open record
+    FC_csv *parser;             // CSV: the parser
+    FC_hist *hist;
+
+    // Filled in by FC_sniff_rank():
+    unsigned long fieldcount;       // the most common field count
+    unsigned long long records;     // all the records
+    unsigned long long consistent;  // ...and those with the most common count
+} FC_sniff_candidate;
+
+// A field count of the same input for every candidate, in one pass: each
+// 64-byte chunk is classified once, into a bitmask for each byte of
+// interest, and every candidate is counted from the masks:
+typedef struct FC_sniff {
+    unsigned char quote;
+    unsigned char bytes[FC_SNIFF_BYTES];    // the byte of each class
+    int nbytes;
+    signed char cls[256];       // the class of every byte, or -1
+    int lf, cr, space, tab, q;  // the classes of the fixed bytes
+    int open;                   // does the open (plain) record hold any bytes yet?
+    FC_sniff_candidate cand[2 * FC_SNIFF_DELIMS];
+    int ncand;
+    int (*kernel) (struct FC_sniff *s, const unsigned char *p, size_t len);
+} FC_sniff;
+
+typedef int (*FC_sniff_kernel) (FC_sniff *s, const unsigned char *p, size_t len);
+
+FC_sniff *FC_sniff_create(const char *delims, unsigned char quote);
+
+void FC_sniff_destroy(FC_sniff *s);
+
+int FC_sniff_block(FC_sniff *s, const char *buf, size_t len);
+
+int FC_sniff_finish(FC_sniff *s);
+
+int FC_sniff_rank(FC_sniff *s, FC_sniff_candidate **ranked);
+
+#endif
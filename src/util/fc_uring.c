@@ -0,0 +1,377 @@
+// -------------------------------------------------------------------------
+// Asynchronous input for many files.
+//
+// Counting a list of small files is mostly waiting on open(2) and read(2),
+// one file after another.  Here the files are opened, and their first
+// blocks read, with io_uring instead: up to DEPTH files ahead of the one
+// being counted, so that their I/O overlaps with the counting (and with
+// each other), and a whole batch of system calls costs one io_uring_enter.
+// The files are taken in the order given, each as an FC_input that starts
+// with the block read (see FC_input_attach).  A file of more than a block
+// goes on to be mapped, as any other.  The blocks are read into DEPTH + 1
+// buffers, which go round: one lent to the file being counted, and the
+// rest to the files in flight.
+//
+// liburing isn't needed: the rings are set up with the system calls.  If
+// io_uring is missing (or the kernel is too old to open files with it),
+// FC_uring_create() returns NULL, and files are opened as usual.
+// -------------------------------------------------------------------------
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "util/dbg.h"
+#include "util/fc_uring.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+enum { FILE_IDLE, FILE_OPENING, FILE_READING, FILE_DONE };
+
+// A file opened (and read) ahead:
+typedef struct FC_uring_file {
+    int state;
+    int fd;
+    char *buf;
+    ssize_t res;        // the bytes read, or -errno
+} FC_uring_file;
+
+struct FC_uring {
+    int fd;
+    void *rings;        // the submission and completion rings
+    size_t rings_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned queued;    // entries not submitted yet
+    int draining;       // is it being destroyed?
+
+    char **files;
+    int nfiles;
+    int depth;
+    size_t blocksize;
+    size_t bufsize;
+    char **bufs;        // the buffers free to read into
+    int nbufs;
+    char *lent;         // the buffer of the last file taken
+    FC_uring_file *slots; // file I is in slot I % DEPTH
+    int next;           // the next file to open
+    int taken;          // the next file to take
+};
+
+// Queue an operation on behalf of file ITEM:
+static void uring_push(FC_uring *u, int op, int fd, const void *addr, unsigned len, unsigned long long off, int flags, int item)
+{
+    unsigned tail = *u->sq_tail;
+    unsigned i = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[i];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)addr;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->open_flags = flags;
+    sqe->user_data = item;
+
+    u->sq_array[i] = i;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    u->queued++;
+}
+
+// Submit the queued operations, and wait for one to complete if WAIT:
+static int uring_enter(FC_uring *u, int wait)
+{
+    int n = 0;
+
+    do {
+        n = syscall(__NR_io_uring_enter, u->fd, u->queued, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (n < 0 && errno == EINTR);
+
+    check(n >= 0, "Error submitting input requests.");
+    u->queued -= n;
+
+    return 0;
+
+error:
+    return -1;
+}
+
+// Open files ahead, up to DEPTH of them past the one to be taken next:
+static void uring_fill(FC_uring *u)
+{
+    while (u->next < u->nfiles && u->next < u->taken + u->depth) {
+        FC_uring_file *f = &u->slots[u->next % u->depth];
+
+        f->fd = -1;
+        f->buf = NULL;
+        f->res = 0;
+
+        // The standard input is left to FC_input_open():
+        if (u->files[u->next][0] == '-') {
+            f->state = FILE_DONE;
+        }
+        else {
+            f->state = FILE_OPENING;
+            uring_push(u, IORING_OP_OPENAT, AT_FDCWD, u->files[u->next], 0, 0, O_RDONLY, u->next);
+        }
+
+        u->next++;
+    }
+}
+
+// File ITEM has been opened (RES is its descriptor), or read (RES bytes):
+static void uring_complete(FC_uring *u, int item, int res)
+{
+    FC_uring_file *f = &u->slots[item % u->depth];
+
+    if (f->state == FILE_OPENING && res >= 0 && !u->draining) {
+        assert(u->nbufs > 0);
+
+        f->fd = res;
+        f->buf = u->bufs[--u->nbufs];
+        f->state = FILE_READING;
+
+        // At the file position (offset -1), which the read moves on, as
+        // read(2) would:
+        uring_push(u, IORING_OP_READ, f->fd, f->buf, u->blocksize, -1ULL, 0, item);
+        return;
+    }
+    else if (f->state == FILE_OPENING && res >= 0) {
+        f->fd = res;
+    }
+
+    f->res = res;
+    f->state = FILE_DONE;
+}
+
+static void uring_reap(FC_uring *u)
+{
+    unsigned head = *u->cq_head;
+    unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+        uring_complete(u, cqe->user_data, cqe->res);
+    }
+
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+}
+
+// Set up a ring to open FILES (of which there are NFILES) and read the
+// first BLOCKSIZE bytes of each, DEPTH files at a time.  Returns NULL if
+// io_uring can't be used:
+FC_uring *FC_uring_create(char **files, int nfiles, int depth, size_t blocksize)
+{
+    long pagesize = sysconf(_SC_PAGESIZE);
+    struct io_uring_params p;
+    FC_uring *u = NULL;
+    void *buf = NULL;
+    int i = 0;
+
+    assert(files != NULL && nfiles > 0 && depth > 0 && blocksize > 0);
+
+    if (pagesize <= 0) pagesize = 4096;
+
+    u = calloc(1, sizeof(FC_uring));
+    check_mem(u);
+    u->fd = -1;
+
+    memset(&p, 0, sizeof(p));
+    u->fd = syscall(__NR_io_uring_setup, depth, &p);
+    check_debug(u->fd >= 0, "io_uring is not available: %s", clean_errno());
+
+    // Opening files with the caller's credentials takes Linux 5.12 (which
+    // also maps both rings at once):
+    check_debug(p.features & IORING_FEAT_NATIVE_WORKERS, "io_uring is too old to open files");
+
+    u->rings_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    if (u->rings_len < p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe)) {
+        u->rings_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    }
+
+    u->rings = mmap(NULL, u->rings_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    check(u->rings != MAP_FAILED, "Error mapping the io_uring rings.");
+
+    u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    check(u->sqes != MAP_FAILED, "Error mapping the io_uring entries.");
+
+    u->sq_tail = (unsigned *)((char *)u->rings + p.sq_off.tail);
+    u->sq_mask = (unsigned *)((char *)u->rings + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *)((char *)u->rings + p.sq_off.array);
+    u->cq_head = (unsigned *)((char *)u->rings + p.cq_off.head);
+    u->cq_tail = (unsigned *)((char *)u->rings + p.cq_off.tail);
+    u->cq_mask = (unsigned *)((char *)u->rings + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)((char *)u->rings + p.cq_off.cqes);
+
+    u->slots = calloc(depth, sizeof(FC_uring_file));
+    check_mem(u->slots);
+    for (i = 0; i < depth; i++) {
+        u->slots[i].fd = -1;
+    }
+
+    u->files = files;
+    u->nfiles = nfiles;
+    u->depth = depth;
+    u->blocksize = blocksize;
+    u->bufsize = (blocksize + pagesize - 1) / pagesize * pagesize;
+
+    u->bufs = calloc(depth + 1, sizeof(char *));
+    check_mem(u->bufs);
+    for (i = 0; i < depth + 1; i++) {
+        check(posix_memalign(&buf, pagesize, u->bufsize) == 0, "Out of memory.");
+        u->bufs[u->nbufs++] = buf;
+    }
+
+    uring_fill(u);
+    check(uring_enter(u, 0) == 0, "Error starting input.");
+
+    return u;
+
+error:
+    FC_uring_destroy(u);
+    return NULL;
+}
+
+// Open FILENAME, the next of the files, as IN (see FC_input_open).  IN
+// must be closed before the next file is taken:
+int FC_uring_open(FC_uring *u, const char *filename, FC_input *in)
+{
+    FC_uring_file *f = NULL;
+    FC_uring_file done;
+
+    assert(u != NULL && filename != NULL && in != NULL);
+
+    if (u->taken >= u->nfiles || strcmp(filename, u->files[u->taken]) != 0) {
+        return FC_input_open(in, filename, u->blocksize);
+    }
+
+    // The last file taken is done with its buffer:
+    if (u->lent) {
+        u->bufs[u->nbufs++] = u->lent;
+        u->lent = NULL;
+    }
+
+    f = &u->slots[u->taken % u->depth];
+
+    while (f->state != FILE_DONE) {
+        check(uring_enter(u, 1) == 0, "Error waiting for input.");
+        uring_reap(u);
+    }
+
+    // Start on the next file before this one is counted:
+    done = *f;
+    f->state = FILE_IDLE;
+    u->taken++;
+    uring_fill(u);
+    check(uring_enter(u, 0) == 0, "Error submitting input requests.");
+
+    if (done.fd < 0 && done.res == 0) {
+        return FC_input_open(in, filename, u->blocksize);
+    }
+
+    u->lent = done.buf;
+
+    // A failed read is left to be read again (and fail) as usual:
+    if (done.res < 0 && done.buf != NULL) {
+        done.res = 0;
+    }
+
+    if (done.res < 0) {
+        if (done.fd >= 0) close(done.fd);
+        errno = -done.res;
+        goto error;
+    }
+
+    return FC_input_attach(in, done.fd, done.buf, done.res, u->blocksize);
+
+error:
+    // Leave IN to be closed, as FC_input_open() does:
+    memset(in, 0, sizeof(*in));
+    in->fd = -1;
+    return -1;
+}
+
+void FC_uring_destroy(FC_uring *u)
+{
+    int i = 0;
+
+    if (u == NULL) return;
+
+    // The kernel may still write to the buffers of the files in flight:
+    if (u->slots) {
+        u->draining = 1;
+
+        for (i = u->taken; i < u->next; i++) {
+            FC_uring_file *f = &u->slots[i % u->depth];
+
+            while (f->state != FILE_DONE && uring_enter(u, 1) == 0) {
+                uring_reap(u);
+            }
+
+            if (f->fd >= 0) close(f->fd);
+            free(f->buf);
+        }
+
+        free(u->slots);
+    }
+
+    if (u->bufs) {
+        for (i = 0; i < u->nbufs; i++) {
+            free(u->bufs[i]);
+        }
+        free(u->bufs);
+    }
+    free(u->lent);
+
+    if (u->sqes && u->sqes != MAP_FAILED) munmap(u->sqes, u->sqes_len);
+    if (u->rings && u->rings != MAP_FAILED) munmap(u->rings, u->rings_len);
+    if (u->fd >= 0) close(u->fd);
+
+    free(u);
+}
+
+#else
+
+struct FC_uring {
+    int unused;
+};
+
+FC_uring *FC_uring_create(char **files, int nfiles, int depth, size_t blocksize)
+{
+    (void)files;
+    (void)nfiles;
+    (void)depth;
+    (void)blocksize;
+
+    debug("io_uring is not available: not built with it");
+
+    return NULL;
+}
+
+int FC_uring_open(FC_uring *u, const char *filename, FC_input *in)
+{
+    (void)u;
+    (void)filename;
+    (void)in;
+
+    return -1;
+}
+
+void FC_uring_destroy(FC_uring *u)
+{
+    (void)u;
+}
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef _FC_uring_h
+#define _FC_uring_h
+
+#include <util/fc_input.h>
+
+// The default number of files opened and read ahead at once:
+#define FC_URING_DEPTH 8
+
+// A list of files opened and read ahead, a first block each, with io_uring:
+typedef struct FC_uring FC_uring;
+
+FC_uring *FC_uring_create(char **files, int nfiles, int depth, size_t blocksize);
+
+int FC_uring_open(FC_uring *u, const char *filename, FC_input *in);
+
+void FC_uring_destroy(FC_uring *u);
+
+#endif
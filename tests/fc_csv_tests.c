@@ -0,0 +1,384 @@
+#include "fc_sample.h"
+#include <util/fc_hist.h>
+#include <util/fc_csv.h>
+#include <util/fc_parallel.h>
+#include <util/csv.h>
+
+// The delimiter and quote of a count:
+struct csv_mode {
+    char delim;
+    char quote;
+};
+
+// The reference: libcsv, counting fields in its callbacks:
+struct ref_counts {
+    unsigned long fields;
+    DArray *darray;
+};
+
+static void ref_field(void *s, size_t len, void *data)
+{
+    (void)s;
+    (void)len;
+    ((struct ref_counts *)data)->fields++;
+}
+
+static void ref_row(int c, void *data)
+{
+    struct ref_counts *counts = data;
+
+    (void)c;
+    FC_array_push(counts->darray, counts->fields);
+    counts->fields = 0;
+}
+
+static DArray *reference_count(const char *buf, size_t len, size_t blocksize, const void *mode)
+{
+    struct ref_counts counts = { 0, DArray_create(sizeof(FCount), 10) };
+    const struct csv_mode *m = mode;
+    struct csv_parser p;
+
+    (void)blocksize;
+
+    csv_init(&p, 0);
+    csv_set_delim(&p, m->delim);
+    csv_set_quote(&p, m->quote);
+    csv_parse(&p, buf, len, ref_field, ref_row, &counts);
+    csv_fini(&p, ref_field, ref_row, &counts);
+    csv_free(&p);
+
+    return counts.darray;
+}
+
+static DArray *csv_count(const char *buf, size_t len, size_t blocksize, const void *mode)
+{
+    DArray *darray = DArray_create(sizeof(FCount), 10);
+    FC_hist *hist = FC_hist_create();
+    const struct csv_mode *m = mode;
+    FC_csv csv;
+    size_t i = 0;
+
+    FC_csv_init(&csv, m->delim, m->quote);
+
+    for (i = 0; i < len; i += blocksize) {
+        size_t n = (len - i < blocksize) ? len - i : blocksize;
+        FC_csv_block(&csv, buf + i, n, hist);
+    }
+
+    FC_csv_finish(&csv, hist);
+    FC_hist_to_array(hist, darray);
+    FC_hist_destroy(hist);
+
+    return darray;
+}
+
+// Compare every engine with libcsv on the first LEN bytes of the sample:
+static char *check_sample(size_t len, char delim, char quote)
+{
+    struct csv_mode mode = { delim, quote };
+
+    return check_engines(reference_count, csv_count, &mode, len);
+}
+
+// Random input drawn from ALPHABET:
+static char *check_alphabet(const char *alphabet, char delim, char quote)
+{
+    size_t n = strlen(alphabet);
+    char *msg = NULL;
+    int round = 0;
+    size_t i = 0;
+
+    for (round = 0; round < 20; round++) {
+        size_t len = SAMPLE_SIZE - rand() % 100;
+
+        for (i = 0; i < len; i++) {
+            sample[i] = alphabet[rand() % n];
+        }
+
+        if ((msg = check_sample(len, delim, quote))) return msg;
+    }
+
+    return NULL;
+}
+
+// Mostly well-formed CSV (so that the vector kernels do most of the work),
+// with quoted fields holding delimiters, newlines and doubled quotes, and
+// the odd malformed byte:
+static char *check_wellformed(int malformed)
+{
+    const char *fields[] = { "abc", "", "12.5", "\"x,y\"", "\"a \"\"q\"\" b\"", "\"line\nbreak\"",
+                             "\"\"", "\"\r\n\"", " pad ", "\"\"\"\"" };
+    const char *junk = "\" \t\r";
+    char *msg = NULL;
+    int round = 0;
+    size_t len = 0;
+
+    for (round = 0; round < 10; round++) {
+        len = 0;
+
+        while (len < SAMPLE_SIZE - 64) {
+            const char *f = fields[rand() % 10];
+            size_t flen = strlen(f);
+            int r = rand() % 8;
+
+            memcpy(sample + len, f, flen);
+            len += flen;
+
+            if (malformed && rand() % 50 == 0) {
+                sample[len++] = junk[rand() % 4];
+            }
+
+            if (r < 5) sample[len++] = ',';
+            else if (r < 7) sample[len++] = '\n';
+            else {
+                sample[len++] = '\r';
+                sample[len++] = '\n';
+            }
+        }
+
+        if ((msg = check_sample(len, ',', '"'))) return msg;
+    }
+
+    return NULL;
+}
+
+// Long stretches with no quotes (which the vector kernels count as plain
+// delimited text) and the odd quote, opening or closing a field between
+// them:
+static char *check_sparse_quotes(const char *alphabet, char delim)
+{
+    size_t n = strlen(alphabet);
+    char *msg = NULL;
+    int round = 0;
+    size_t i = 0;
+
+    for (round = 0; round < 20; round++) {
+        size_t len = SAMPLE_SIZE - rand() % 100;
+
+        for (i = 0; i < len; i++) {
+            sample[i] = (rand() % 400 == 0) ? '"' : alphabet[rand() % n];
+        }
+
+        if ((msg = check_sample(len, delim, '"'))) return msg;
+    }
+
+    return NULL;
+}
+
+char *test_commas() {
+    return check_alphabet("ab,,\"\" \t\r\n", ',', '"');
+}
+
+char *test_quotes() {
+    return check_alphabet("a,\"\"\"  \n", ',', '"');
+}
+
+char *test_blank_rows() {
+    return check_alphabet("a,  \t\t\r\r\n\n\n", ',', '"');
+}
+
+// Delimiters and quotes that are also spaces, terminators or each other:
+char *test_odd_delimiters() {
+    char *msg = NULL;
+
+    if ((msg = check_alphabet("ab \t\"\r\n", ' ', '"'))) return msg;
+    if ((msg = check_alphabet("ab \t\"\r\n", '\t', '"'))) return msg;
+    if ((msg = check_alphabet("ab,\t'\r\n", ',', '\t'))) return msg;
+    if ((msg = check_alphabet("ab,\"\r\n", '\r', '"'))) return msg;
+    if ((msg = check_alphabet("ab,\" \n", ',', ','))) return msg;
+
+    return NULL;
+}
+
+char *test_sparse_quotes() {
+    char *msg = NULL;
+
+    if ((msg = check_sparse_quotes("abcd,,  \t\r\n\n", ','))) return msg;
+    if ((msg = check_sparse_quotes("abcd  \t\r\n", ' '))) return msg;
+    if ((msg = check_sparse_quotes("abcd,\t\t \n", '\t'))) return msg;
+
+    return NULL;
+}
+
+char *test_wellformed() {
+    return check_wellformed(0);
+}
+
+char *test_malformed() {
+    return check_wellformed(1);
+}
+
+char *test_rows() {
+    FC_csv csv;
+    const char *input = "a,\"b\nc\"\n\n  \r\nd";
+
+    FC_csv_init(&csv, ',', '"');
+    FC_csv_block(&csv, input, strlen(input), NULL);
+    FC_csv_finish(&csv, NULL);
+
+    mu_assert(csv.rows == 2, "wrong number of CSV rows");
+
+    return NULL;
+}
+
+// The reference for --expect: the rows libcsv reports without the
+// expected field count:
+struct ref_expect {
+    unsigned long expect;
+    unsigned long fields;
+    unsigned long long count;
+};
+
+static void ref_expect_field(void *s, size_t len, void *data)
+{
+    (void)s;
+    (void)len;
+    ((struct ref_expect *)data)->fields++;
+}
+
+static void ref_expect_row(int c, void *data)
+{
+    struct ref_expect *r = data;
+
+    (void)c;
+    if (r->fields != r->expect) r->count++;
+    r->fields = 0;
+}
+
+// Check the first LEN bytes of the sample in blocks of BLOCKSIZE:
+static struct expect_result csv_expect(size_t len, size_t blocksize, unsigned long expect)
+{
+    struct expect_result got = { 0, 0, 0 };
+    FC_csv csv;
+    size_t i = 0;
+
+    FC_csv_expect_init(&csv, ',', '"', expect, expect_report, &got);
+
+    for (i = 0; i < len; i += blocksize) {
+        size_t n = (len - i < blocksize) ? len - i : blocksize;
+        FC_csv_expect_block(&csv, sample + i, n);
+    }
+
+    FC_csv_expect_finish(&csv);
+
+    return got;
+}
+
+char *test_expect() {
+    const char *input = "a,b\n\"x\ny\",z,w\n\n  c,d\r\nq";
+    const char *fields[] = { "abc", "", "\"x,y\"", "\"line\nbreak\"", "\"\"\"\"", " pad " };
+    size_t blocksizes[] = { 1, 7, 64, 4096, SAMPLE_SIZE };
+    struct ref_expect want = { 3, 0, 0 };
+    struct expect_result got = { 0, 0, 0 };
+    struct csv_parser p;
+    size_t len = 0;
+    size_t i = 0;
+
+    // A row is reported at the line and offset it starts at, however the
+    // input is cut into blocks:
+    len = strlen(input);
+    memcpy(sample, input, len);
+    for (i = 1; i <= len; i++) {
+        got = csv_expect(len, i, 2);
+        mu_assert(got.count == 2, "wrong number of CSV violations");
+        mu_assert(got.first_line == 2 && got.first_offset == 4, "wrong line or offset of the first CSV violation");
+    }
+
+    got = csv_expect(len - 1, len, 2);
+    mu_assert(got.count == 1, "a CSV row cut short was checked");
+
+    // Random rows, against libcsv:
+    while (len < SAMPLE_SIZE - 64) {
+        const char *f = fields[rand() % 6];
+
+        memcpy(sample + len, f, strlen(f));
+        len += strlen(f);
+        sample[len++] = (rand() % 3) ? ',' : '\n';
+    }
+
+    csv_init(&p, 0);
+    csv_parse(&p, sample, len, ref_expect_field, ref_expect_row, &want);
+    csv_fini(&p, ref_expect_field, ref_expect_row, &want);
+    csv_free(&p);
+
+    for (i = 0; i < sizeof(blocksizes) / sizeof(blocksizes[0]); i++) {
+        got = csv_expect(len, blocksizes[i], 3);
+        mu_assert(got.count == want.count, "CSV violations differ from libcsv's");
+    }
+
+    return NULL;
+}
+
+// Split CSV with many quoted newlines (so that parts often start inside a
+// quoted field) between threads, and compare with a serial count:
+char *test_parallel() {
+    const char *fields[] = { "abc", "", "\"x,y\"", "\"a\nb\nc\nd\ne\nf\"", "\"\"\"\"", "\"\n\"" };
+    size_t len = 4 * FC_PARALLEL_MIN_PART + 123;
+    char *buf = malloc(len);
+    unsigned long long rows = 0;
+    size_t i = 0;
+    int jobs = 0;
+    int ok = 1;
+
+    mu_assert(buf != NULL, "out of memory");
+
+    while (i < len) {
+        const char *f = fields[rand() % 6];
+        size_t flen = strlen(f);
+
+        if (flen > len - i) flen = len - i;
+        memcpy(buf + i, f, flen);
+        i += flen;
+        if (i < len) buf[i++] = (rand() % 3) ? ',' : '\n';
+    }
+
+    struct csv_mode mode = { ',', '"' };
+    DArray *expected = csv_count(buf, len, len, &mode);
+
+    for (jobs = 2; jobs <= 7 && ok; jobs++) {
+        DArray *actual = DArray_create(sizeof(FCount), 10);
+        FC_hist *hist = FC_hist_create();
+        unsigned long long total = 0;
+
+        FC_parallel_csv(buf, len, ',', '"', jobs, 65536, hist, NULL);
+        FC_hist_to_array(hist, actual);
+        ok = same_counts(expected, actual);
+
+        FC_parallel_csv(buf, len, ',', '"', jobs, 65536, NULL, &rows);
+        for (i = 0; i < (size_t)actual->end; i++) {
+            total += ((FCount *)actual->contents[i])->recordcount;
+        }
+        if (rows != total) ok = 0;
+
+        FC_hist_destroy(hist);
+        FC_array_destroy(actual);
+    }
+
+    FC_array_destroy(expected);
+    free(buf);
+
+    mu_assert(ok, "parallel CSV counts differ from the serial counts");
+
+    return NULL;
+}
+
+char *all_tests() {
+    mu_suite_start();
+
+    srand(7);
+
+    mu_run_test(test_commas);
+    mu_run_test(test_quotes);
+    mu_run_test(test_blank_rows);
+    mu_run_test(test_odd_delimiters);
+    mu_run_test(test_sparse_quotes);
+    mu_run_test(test_wellformed);
+    mu_run_test(test_malformed);
+    mu_run_test(test_rows);
+    mu_run_test(test_expect);
+    mu_run_test(test_parallel);
+
+    return NULL;
+}
+
+RUN_TESTS(all_tests);
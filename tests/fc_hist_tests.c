@@ -0,0 +1,98 @@
+#include "minunit.h"
+#include <util/darray.h>
+#include <util/fc_funcs.h>
+#include <util/fc_hist.h>
+
+char *test_dense_and_outliers() {
+    FC_hist *hist = FC_hist_create();
+    unsigned long i = 0;
+
+    mu_assert(hist != NULL, "FC_hist_create failed");
+
+    // Enough large field counts to make the hash table grow a few times:
+    for (i = 0; i < 1000; i++) {
+        FC_hist_add(hist, 3);
+        FC_hist_add(hist, 1000 + i);
+        FC_hist_add(hist, 1000 + i);
+    }
+
+    mu_assert(FC_hist_distinct(hist) == 1001, "wrong number of distinct field counts");
+    mu_assert(FC_hist_get(hist, 3) == 1000, "wrong dense count");
+    mu_assert(FC_hist_get(hist, 1500) == 2, "wrong outlier count");
+    mu_assert(FC_hist_get(hist, 4) == 0, "unseen dense count should be zero");
+    mu_assert(FC_hist_get(hist, 99999) == 0, "unseen outlier count should be zero");
+
+    FC_hist_destroy(hist);
+
+    return NULL;
+}
+
+char *test_merge_order() {
+    FC_hist *a = FC_hist_create();
+    FC_hist *b = FC_hist_create();
+    DArray *darray = DArray_create(sizeof(FCount), 10);
+    FCount *fc = NULL;
+
+    FC_hist_add(a, 5);
+    FC_hist_add(a, 300);
+    FC_hist_add(b, 7);
+    FC_hist_add(b, 5);
+    FC_hist_add(b, 300);
+
+    FC_hist_merge(a, b);
+    FC_hist_to_array(a, darray);
+
+    // First-seen order, as if A and B had been counted in one pass:
+    mu_assert(darray->end == 3, "wrong number of merged field counts");
+    fc = darray->contents[0];
+    mu_assert(fc->fieldcount == 5 && fc->recordcount == 2, "wrong first merged count");
+    fc = darray->contents[1];
+    mu_assert(fc->fieldcount == 300 && fc->recordcount == 2, "wrong second merged count");
+    fc = darray->contents[2];
+    mu_assert(fc->fieldcount == 7 && fc->recordcount == 1, "wrong third merged count");
+
+    FC_array_destroy(darray);
+    FC_hist_destroy(a);
+    FC_hist_destroy(b);
+
+    return NULL;
+}
+
+char *test_save_load() {
+    FC_hist *a = FC_hist_create();
+    FC_hist *b = FC_hist_create();
+    FILE *fp = tmpfile();
+
+    mu_assert(fp != NULL, "tmpfile failed");
+
+    // Counts past 2^32 must survive the round trip:
+    FC_hist_add_n(a, 4, 5000000000ULL);
+    FC_hist_add_n(a, 70000, 3);
+    FC_hist_add(b, 4);
+
+    mu_assert(FC_hist_save(a, fp) == 0, "FC_hist_save failed");
+    rewind(fp);
+    mu_assert(FC_hist_load(b, fp) == 0, "FC_hist_load failed");
+
+    mu_assert(FC_hist_distinct(b) == 2, "wrong number of loaded field counts");
+    mu_assert(FC_hist_get(b, 4) == 5000000001ULL, "wrong 64-bit count after load");
+    mu_assert(FC_hist_get(b, 70000) == 3, "wrong outlier count after load");
+
+    fclose(fp);
+    FC_hist_destroy(a);
+    FC_hist_destroy(b);
+
+    return NULL;
+}
+
+char *all_tests() {
+    mu_suite_start();
+
+    mu_run_test(test_dense_and_outliers);
+    mu_run_test(test_merge_order);
+    mu_run_test(test_save_load);
+
+    return NULL;
+}
+
+RUN_TESTS(all_tests);
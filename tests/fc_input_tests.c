@@ -0,0 +1,449 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include "minunit.h"
+#include <signal.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <util/fc_input.h>
+#include <util/fc_uring.h>
+#include <util/fc_decode.h>
+
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+#include <zlib.h>
+#endif
+
+#if defined(HAVE_LZMA_H) && defined(HAVE_LIBLZMA)
+#include <lzma.h>
+#endif
+
+#define SAMPLE_SIZE 300000
+#define BLOCK_SIZE 4096
+
+static char sample[SAMPLE_SIZE];
+
+// Start a child writing the sample to a pipe (in uneven pieces, over and
+// over if FOREVER), and return the name of the pipe's read end:
+static pid_t start_writer(int forever, char *name, size_t size)
+{
+    int fds[2];
+    pid_t pid = 0;
+
+    if (pipe(fds) != 0) return -1;
+
+    pid = fork();
+    if (pid == 0) {
+        size_t pos = 0;
+
+        close(fds[0]);
+        do {
+            for (pos = 0; pos < SAMPLE_SIZE; ) {
+                size_t n = 1 + rand() % 5000;
+                if (n > SAMPLE_SIZE - pos) n = SAMPLE_SIZE - pos;
+                if (write(fds[1], sample + pos, n) != (ssize_t)n) _exit(1);
+                pos += n;
+            }
+        } while (forever);
+        _exit(0);
+    }
+
+    close(fds[1]);
+    snprintf(name, size, "/dev/fd/%d", fds[0]);
+
+    return pid;
+}
+
+// Read the sample back through a pipe, carrying over KEEP bytes (or a
+// random number of them, up to KEEP, if RANDOM) from block to block:
+static char *read_back(size_t keep, int random)
+{
+    char name[64];
+    FC_input in;
+    const char *block = NULL;
+    ssize_t len = 0;
+    size_t carried = 0;
+    size_t pos = 0;     // how much of the sample has been read
+    pid_t pid = start_writer(0, name, sizeof(name));
+    int status = 0;
+
+    mu_assert(pid > 0, "failed to start the writer");
+    mu_assert(FC_input_open(&in, name, BLOCK_SIZE) == 0, "failed to open the pipe");
+    mu_assert(in.ring != NULL, "a pipe isn't read ahead");
+
+    while ((len = FC_input_next(&in, &block, carried)) > (ssize_t)carried) {
+        mu_assert(memcmp(block, sample + pos - carried, len) == 0, "wrong bytes in a block");
+        pos += len - carried;
+
+        carried = random ? rand() % (keep + 1) : keep;
+        if (carried > (size_t)len) carried = len;
+    }
+
+    mu_assert(len == (ssize_t)carried, "wrong length of the last block");
+    mu_assert(memcmp(block, sample + pos - carried, len) == 0, "wrong bytes carried over at the end");
+    mu_assert(pos == SAMPLE_SIZE, "wrong length of input");
+
+    FC_input_close(&in);
+    close(atoi(name + strlen("/dev/fd/")));
+    waitpid(pid, &status, 0);
+
+    return NULL;
+}
+
+char *test_blocks() {
+    return read_back(0, 0);
+}
+
+char *test_carry() {
+    char *msg = NULL;
+
+    if ((msg = read_back(3, 0))) return msg;
+    if ((msg = read_back(100, 1))) return msg;
+
+    return NULL;
+}
+
+// Carrying over more than a block, which can't be done in place:
+char *test_long_carry() {
+    char *msg = NULL;
+
+    if ((msg = read_back(3 * BLOCK_SIZE, 1))) return msg;
+    if ((msg = read_back(50000, 0))) return msg;
+
+    return NULL;
+}
+
+// Closing a pipe that's still being written to stops its reader:
+char *test_early_close() {
+    char name[64];
+    FC_input in;
+    const char *block = NULL;
+    pid_t pid = start_writer(1, name, sizeof(name));
+    int status = 0;
+
+    mu_assert(pid > 0, "failed to start the writer");
+    mu_assert(FC_input_open(&in, name, BLOCK_SIZE) == 0, "failed to open the pipe");
+    mu_assert(FC_input_next(&in, &block, 0) == BLOCK_SIZE, "wrong length of a block");
+    mu_assert(memcmp(block, sample, BLOCK_SIZE) == 0, "wrong bytes in a block");
+
+    FC_input_close(&in);
+    close(atoi(name + strlen("/dev/fd/")));
+    kill(pid, SIGTERM);
+    waitpid(pid, &status, 0);
+
+    return NULL;
+}
+
+// Files of every size up to a few blocks, opened and read ahead:
+char *test_uring() {
+    char *files[20];
+    char name[64];
+    FC_uring *u = NULL;
+    FC_input in;
+    const char *block = NULL;
+    ssize_t len = 0;
+    size_t pos = 0;
+    int i = 0;
+
+    for (i = 0; i < 20; i++) {
+        FILE *fp = NULL;
+
+        snprintf(name, sizeof(name), "tests/fc_input_%d.tmp", i);
+        files[i] = strdup(name);
+        fp = fopen(name, "w");
+        mu_assert(fp != NULL, "failed to write a test file");
+        fwrite(sample, 1, (i == 0) ? 0 : (i == 1) ? BLOCK_SIZE : i * 777, fp);
+        fclose(fp);
+    }
+
+    u = FC_uring_create(files, 20, 4, BLOCK_SIZE);
+    if (u == NULL) debug("io_uring isn't available, skipping");
+
+    for (i = 0; i < 20 && u != NULL; i++) {
+        size_t size = (i == 0) ? 0 : (i == 1) ? BLOCK_SIZE : i * 777;
+        size_t carried = 0;
+
+        mu_assert(FC_uring_open(u, files[i], &in) == 0, "failed to open a file");
+
+        pos = 0;
+        while ((len = FC_input_next(&in, &block, carried)) > (ssize_t)carried) {
+            mu_assert(memcmp(block, sample + pos - carried, len) == 0, "wrong bytes in a block");
+            pos += len - carried;
+            carried = (len > 3) ? 3 : len;
+        }
+
+        mu_assert(pos == size, "wrong length of a file");
+        FC_input_close(&in);
+    }
+
+    FC_uring_destroy(u);
+
+    for (i = 0; i < 20; i++) {
+        unlink(files[i]);
+        free(files[i]);
+    }
+
+    return NULL;
+}
+
+// Read a file on the standard input from SKIP bytes in (as after a header
+// line was read off it), and check that it's left at its end:
+static char *read_stdin(const char *name, off_t skip)
+{
+    FC_input in;
+    const char *block = NULL;
+    ssize_t len = 0;
+    size_t pos = skip;
+    size_t carried = 0;
+    int saved = dup(STDIN_FILENO);
+    int fd = open(name, O_RDONLY);
+
+    mu_assert(saved >= 0 && fd >= 0, "failed to open a test file");
+    mu_assert(lseek(fd, skip, SEEK_SET) == skip, "failed to skip into a test file");
+    dup2(fd, STDIN_FILENO);
+    close(fd);
+
+    mu_assert(FC_input_open(&in, "-", BLOCK_SIZE) == 0, "failed to open the standard input");
+
+    while ((len = FC_input_next(&in, &block, carried)) > (ssize_t)carried) {
+        mu_assert(memcmp(block, sample + pos - carried, len) == 0, "wrong bytes in a block");
+        pos += len - carried;
+        carried = (len > 3) ? 3 : len;
+    }
+
+    FC_input_close(&in);
+
+    mu_assert(pos == SAMPLE_SIZE, "wrong length of the standard input");
+    mu_assert(lseek(STDIN_FILENO, 0, SEEK_CUR) == SAMPLE_SIZE, "the standard input wasn't left at its end");
+
+    dup2(saved, STDIN_FILENO);
+    close(saved);
+
+    return NULL;
+}
+
+// A regular file on the standard input, whole and part-read:
+char *test_stdin_offset() {
+    const char *name = "tests/fc_input_stdin.tmp";
+    FILE *fp = fopen(name, "w");
+    char *msg = NULL;
+
+    mu_assert(fp != NULL, "failed to write a test file");
+    fwrite(sample, 1, SAMPLE_SIZE, fp);
+    fclose(fp);
+
+    if (!msg) msg = read_stdin(name, 0);
+    if (!msg) msg = read_stdin(name, 100);
+    if (!msg) msg = read_stdin(name, SAMPLE_SIZE - 1);
+
+    unlink(name);
+
+    return msg;
+}
+
+#if (defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)) || (defined(HAVE_LZMA_H) && defined(HAVE_LIBLZMA))
+// Read a compressed input back (decoding it on up to JOBS threads),
+// carrying 3 bytes over, and return how many bytes came out (or -1 on an
+// error):
+static ssize_t read_decoded(const char *name, int jobs)
+{
+    FC_input in;
+    const char *block = NULL;
+    ssize_t len = 0;
+    ssize_t i = 0;
+    size_t carried = 0;
+    size_t pos = 0;     // the sample is repeated, so byte POS is sample[POS % SAMPLE_SIZE]
+
+    if (FC_input_open_jobs(&in, name, BLOCK_SIZE, jobs) != 0) return -1;
+
+    while ((len = FC_input_next(&in, &block, carried)) > (ssize_t)carried) {
+        for (i = carried; i < len; i++) {
+            if (block[i] != sample[pos++ % SAMPLE_SIZE]) break;
+        }
+        if (i < len) break;
+
+        carried = (len > 3) ? 3 : len;
+    }
+
+    FC_input_close(&in);
+
+    return (len < 0 || len > (ssize_t)carried) ? -1 : (ssize_t)pos;
+}
+#endif
+
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+// A gzip file of two members (the sample twice), mapped and piped, and the
+// same file cut short:
+char *test_gzip() {
+    const char *name = "tests/fc_input_gz.tmp";
+    char cmd[128];
+    gzFile gz = NULL;
+    FILE *fp = NULL;
+    long size = 0;
+    int i = 0;
+
+    for (i = 0; i < 2; i++) {
+        gz = gzopen(name, i == 0 ? "wb" : "ab");
+        mu_assert(gz != NULL, "failed to write a gzip file");
+        mu_assert(gzwrite(gz, sample, SAMPLE_SIZE) == SAMPLE_SIZE, "failed to write a gzip file");
+        gzclose(gz);
+    }
+
+    mu_assert(read_decoded(name, 1) == 2 * SAMPLE_SIZE, "wrong length of a gzip file");
+
+    snprintf(cmd, sizeof(cmd), "cat %s", name);
+    fp = popen(cmd, "r");
+    mu_assert(fp != NULL, "failed to start cat");
+    snprintf(cmd, sizeof(cmd), "/dev/fd/%d", fileno(fp));
+    mu_assert(read_decoded(cmd, 1) == 2 * SAMPLE_SIZE, "wrong length of a piped gzip file");
+    pclose(fp);
+
+    fp = fopen(name, "r+");
+    mu_assert(fp != NULL, "failed to open a gzip file");
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fclose(fp);
+    mu_assert(truncate(name, size - 10) == 0, "failed to truncate a gzip file");
+    mu_assert(read_decoded(name, 1) == -1, "a truncated gzip file was read");
+
+    unlink(name);
+
+    return NULL;
+}
+
+// Write LEN bytes at DATA to FP as a BGZF member (a gzip member with its
+// length in a "BC" extra field):
+static int write_bgzf(FILE *fp, const char *data, size_t len)
+{
+    unsigned char out[2 * BLOCK_SIZE];
+    unsigned char head[18] = { 0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0 };
+    unsigned char tail[8];
+    unsigned long crc = crc32(0, (const Bytef *)data, len);
+    size_t size = 0;
+    z_stream z;
+    int i = 0;
+
+    memset(&z, 0, sizeof(z));
+    if (deflateInit2(&z, 6, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) return -1;
+
+    z.next_in = (Bytef *)data;
+    z.avail_in = len;
+    z.next_out = out;
+    z.avail_out = sizeof(out);
+    if (deflate(&z, Z_FINISH) != Z_STREAM_END) return -1;
+    size = sizeof(out) - z.avail_out;
+    deflateEnd(&z);
+
+    head[16] = (sizeof(head) + size + sizeof(tail) - 1) & 0xff;
+    head[17] = (sizeof(head) + size + sizeof(tail) - 1) >> 8;
+    for (i = 0; i < 4; i++) {
+        tail[i] = crc >> (8 * i);
+        tail[4 + i] = len >> (8 * i);
+    }
+
+    fwrite(head, 1, sizeof(head), fp);
+    fwrite(out, 1, size, fp);
+    fwrite(tail, 1, sizeof(tail), fp);
+
+    return 0;
+}
+
+// A BGZF file (the sample twice, in members of uneven lengths) decoded in
+// chunks on several threads, and on one:
+char *test_bgzf() {
+    const char *name = "tests/fc_input_bgzf.tmp";
+    FILE *fp = fopen(name, "w");
+    size_t pos = 0;
+    size_t n = 0;
+
+    mu_assert(fp != NULL, "failed to write a BGZF file");
+
+    for (pos = 0; pos < 2 * SAMPLE_SIZE; pos += n) {
+        n = 1 + rand() % 3000;
+        if (n > SAMPLE_SIZE - pos % SAMPLE_SIZE) n = SAMPLE_SIZE - pos % SAMPLE_SIZE;
+        mu_assert(write_bgzf(fp, sample + pos % SAMPLE_SIZE, n) == 0, "failed to write a BGZF member");
+    }
+    mu_assert(write_bgzf(fp, sample, 0) == 0, "failed to write a BGZF member");
+    fclose(fp);
+
+    mu_assert(read_decoded(name, 3) == 2 * SAMPLE_SIZE, "wrong length of a BGZF file on 3 threads");
+    mu_assert(read_decoded(name, 1) == 2 * SAMPLE_SIZE, "wrong length of a BGZF file");
+
+    unlink(name);
+
+    return NULL;
+}
+#endif
+
+#if defined(HAVE_LZMA_H) && defined(HAVE_LIBLZMA)
+// An xz file with a 4 MiB dictionary is decoded with no limit, and is an
+// error within 1 MiB:
+char *test_xz_limit() {
+    const char *name = "tests/fc_input_xz.tmp";
+    static uint8_t out[SAMPLE_SIZE];
+    lzma_stream xz = LZMA_STREAM_INIT;
+    lzma_options_lzma opt;
+    lzma_filter filters[2];
+    FILE *fp = NULL;
+
+    mu_assert(lzma_lzma_preset(&opt, 0) == 0, "failed to set up xz");
+    opt.dict_size = 4 << 20;
+    filters[0].id = LZMA_FILTER_LZMA2;
+    filters[0].options = &opt;
+    filters[1].id = LZMA_VLI_UNKNOWN;
+    mu_assert(lzma_stream_encoder(&xz, filters, LZMA_CHECK_CRC32) == LZMA_OK, "failed to start xz");
+
+    xz.next_in = (const uint8_t *)sample;
+    xz.avail_in = SAMPLE_SIZE;
+    xz.next_out = out;
+    xz.avail_out = sizeof(out);
+    mu_assert(lzma_code(&xz, LZMA_FINISH) == LZMA_STREAM_END, "failed to write an xz file");
+
+    fp = fopen(name, "w");
+    mu_assert(fp != NULL, "failed to write an xz file");
+    fwrite(out, 1, sizeof(out) - xz.avail_out, fp);
+    fclose(fp);
+    lzma_end(&xz);
+
+    mu_assert(read_decoded(name, 1) == SAMPLE_SIZE, "wrong length of an xz file");
+
+    FC_decode_limit(1 << 20);
+    mu_assert(read_decoded(name, 1) == -1, "an xz file was decoded past the limit");
+    FC_decode_limit(0);
+
+    unlink(name);
+
+    return NULL;
+}
+#endif
+
+char *all_tests() {
+    size_t i = 0;
+
+    mu_suite_start();
+
+    srand(7);
+    signal(SIGPIPE, SIG_IGN);
+    for (i = 0; i < SAMPLE_SIZE; i++) {
+        sample[i] = 'a' + rand() % 26;
+    }
+
+    mu_run_test(test_blocks);
+    mu_run_test(test_carry);
+    mu_run_test(test_long_carry);
+    mu_run_test(test_early_close);
+    mu_run_test(test_uring);
+    mu_run_test(test_stdin_offset);
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+    mu_run_test(test_gzip);
+    mu_run_test(test_bgzf);
+#endif
+#if defined(HAVE_LZMA_H) && defined(HAVE_LIBLZMA)
+    mu_run_test(test_xz_limit);
+#endif
+
+    return NULL;
+}
+
+RUN_TESTS(all_tests);
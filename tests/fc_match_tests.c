@@ -0,0 +1,215 @@
+#include "fc_sample.h"
+#include <string.h>
+#include <util/fc_hist.h>
+#include <util/fc_match.h>
+
+// The reference: the delimiters strstr() would find in every line, left
+// to right and never overlapping, but reading NULs as data:
+static DArray *reference_count(const char *buf, size_t len, size_t blocksize, const void *mode)
+{
+    DArray *darray = DArray_create(sizeof(FCount), 10);
+    const char *delim = mode;
+    const size_t dlen = strlen(delim);
+    size_t start = 0;
+    size_t i = 0;
+
+    (void)blocksize;
+
+    for (i = 0; i < len; i++) {
+        if (buf[i] == '\n' || i == len - 1) {
+            size_t n = i + 1 - start;
+            unsigned long dc = 0;
+            size_t k = 0;
+
+            while (k + dlen <= n) {
+                if (memcmp(buf + start + k, delim, dlen) == 0) {
+                    dc++;
+                    k += dlen;
+                } else {
+                    k++;
+                }
+            }
+
+            FC_array_push(darray, dc + 1);
+            start = i + 1;
+        }
+    }
+
+    return darray;
+}
+
+// Match the buffer in blocks of the given size, carrying bytes over from
+// one block to the next as asked:
+static DArray *match_count(const char *buf, size_t len, size_t blocksize, const void *mode)
+{
+    DArray *darray = DArray_create(sizeof(FCount), 10);
+    FC_hist *hist = FC_hist_create();
+    FC_match m;
+    size_t pos = 0;
+    size_t keep = 0;
+
+    if (FC_match_init(&m, mode) != 0) return darray;
+
+    while (pos < len) {
+        size_t n = (len - pos < blocksize) ? len - pos : blocksize;
+
+        FC_match_block(&m, buf + pos - keep, keep + n, &keep, hist);
+        pos += n;
+    }
+
+    FC_match_finish(&m, hist);
+
+    FC_hist_to_array(hist, darray);
+    FC_hist_destroy(hist);
+
+    return darray;
+}
+
+static char *check_sample(const char *delim)
+{
+    return check_engines(reference_count, match_count, delim, SAMPLE_SIZE);
+}
+
+char *test_delimiters() {
+    const char *delims[] = { "||", "|~", "~|~", "|||", "~|~|", "~~|~~|", "|~|~|~|~|" };
+    char *msg = NULL;
+    size_t i = 0;
+
+    for (i = 0; i < sizeof(delims) / sizeof(delims[0]); i++) {
+        fill_sample("a||~~|\n");
+        if ((msg = check_sample(delims[i]))) return msg;
+    }
+
+    return NULL;
+}
+
+// Long lines, so that matches straddle the vector chunks:
+char *test_long_lines() {
+    char *msg = NULL;
+
+    fill_sample("a||~~||||~~||~|~");
+    if ((msg = check_sample("~|~"))) return msg;
+    if ((msg = check_sample("||"))) return msg;
+
+    return NULL;
+}
+
+char *test_nuls() {
+    char *msg = NULL;
+
+    fill_sample("a?|\0\0\n");
+    if ((msg = check_sample("?|"))) return msg;
+    if ((msg = check_sample("|??"))) return msg;
+    if ((msg = check_sample("a|"))) return msg;
+
+    return NULL;
+}
+
+// Records padded out with runs of NULs (as mainframe extracts are):
+char *test_nul_padding() {
+    char *msg = NULL;
+    int i = 0;
+
+    for (i = 0; i < SAMPLE_SIZE; i++) {
+        sample[i] = (i % 97 == 96) ? '\n' : (i % 97 < 40) ? "ab~|"[rand() % 4] : '\0';
+    }
+    if ((msg = check_sample("~|"))) return msg;
+    if ((msg = check_sample("|?"))) return msg;
+    if ((msg = check_sample("???"))) return msg;
+
+    return NULL;
+}
+
+// A newline can only end a delimiter, since it ends the line:
+char *test_newlines() {
+    char *msg = NULL;
+
+    fill_sample("ab|\n\n");
+    if ((msg = check_sample("|\n"))) return msg;
+    if ((msg = check_sample("\n|"))) return msg;
+    if ((msg = check_sample("b\n\n"))) return msg;
+
+    return NULL;
+}
+
+char *test_expect() {
+    size_t blocksizes[] = { 1, 63, 64, 65, 4096, SAMPLE_SIZE };
+    struct expect_result want = { 0, 0, 0 };
+    unsigned long long line = 0;
+    size_t start = 0;
+    int dc = 0;
+    const FC_engine *e = NULL;
+    size_t i = 0, j = 0;
+
+    fill_sample("abc~|~|~\n");
+
+    // The reference: a byte at a time, expecting 3 fields:
+    for (i = 0; i < SAMPLE_SIZE; i++) {
+        if (i + 3 <= SAMPLE_SIZE && memcmp(sample + i, "~|~", 3) == 0) {
+            dc++;
+            i += 2;
+        }
+        if (sample[i] == '\n' || i >= SAMPLE_SIZE - 1) {
+            line++;
+            if (dc + 1 != 3 && want.count++ == 0) {
+                want.first_line = line;
+                want.first_offset = start;
+            }
+            start = i + 1;
+            dc = 0;
+        }
+    }
+
+    for (e = FC_engines; e->name != NULL; e++) {
+        if (!FC_engine_supported(e)) continue;
+        mu_assert(FC_engine_select(e->name) == 0, "failed to select a supported engine");
+
+        for (j = 0; j < sizeof(blocksizes) / sizeof(blocksizes[0]); j++) {
+            struct expect_result got = { 0, 0, 0 };
+            size_t keep = 0;
+            FC_match m;
+
+            mu_assert(FC_match_expect_init(&m, "~|~", 3, expect_report, &got) == 0, "failed to start a scan");
+            for (i = 0; i < SAMPLE_SIZE; i += blocksizes[j]) {
+                size_t n = (SAMPLE_SIZE - i < blocksizes[j]) ? SAMPLE_SIZE - i : blocksizes[j];
+                FC_match_block(&m, sample + i - keep, keep + n, &keep, NULL);
+            }
+            FC_match_finish(&m, NULL);
+
+            mu_assert(got.count == want.count, "wrong number of violations");
+            mu_assert(got.first_line == want.first_line, "wrong line of the first violation");
+            mu_assert(got.first_offset == want.first_offset, "wrong offset of the first violation");
+        }
+    }
+
+    return NULL;
+}
+
+// Shorter delimiters are the scanner's, and an empty one can't be matched:
+char *test_short_delimiters() {
+    FC_match m;
+
+    mu_assert(FC_match_init(&m, "") != 0, "an empty delimiter was taken");
+    mu_assert(FC_match_init(&m, "|") != 0, "a single-byte delimiter was taken");
+    mu_assert(FC_match_init(&m, "||") == 0, "a two-byte delimiter was refused");
+
+    return NULL;
+}
+
+char *all_tests() {
+    mu_suite_start();
+
+    srand(11);
+
+    mu_run_test(test_delimiters);
+    mu_run_test(test_long_lines);
+    mu_run_test(test_nuls);
+    mu_run_test(test_nul_padding);
+    mu_run_test(test_newlines);
+    mu_run_test(test_expect);
+    mu_run_test(test_short_delimiters);
+
+    return NULL;
+}
+
+RUN_TESTS(all_tests);
@@ -0,0 +1,119 @@
+#ifndef _fc_sample_h
+#define _fc_sample_h
+
+// What the counting tests share: a sample of random input, and a check
+// that every engine counts it as a reference does.
+
+#include "minunit.h"
+#include <util/darray.h>
+#include <util/fc_funcs.h>
+#include <util/fc_engine.h>
+
+#ifndef SAMPLE_SIZE
+#define SAMPLE_SIZE 20000
+#endif
+
+static char sample[SAMPLE_SIZE];
+
+// Fill the sample with random bytes drawn from an alphabet (which may hold NULs):
+#define fill_sample(A) fill_sample_from((A), sizeof(A) - 1)
+
+static inline void fill_sample_from(const char *alphabet, size_t n)
+{
+    int i = 0;
+
+    for (i = 0; i < SAMPLE_SIZE; i++) {
+        sample[i] = alphabet[rand() % n];
+    }
+}
+
+static inline int same_counts(DArray *a, DArray *b)
+{
+    int i = 0;
+
+    if (a->end != b->end) return 0;
+
+    for (i = 0; i < a->end; i++) {
+        FCount *x = a->contents[i];
+        FCount *y = b->contents[i];
+        if (x->fieldcount != y->fieldcount || x->recordcount != y->recordcount) return 0;
+    }
+
+    return 1;
+}
+
+// Count the LEN bytes at BUF in blocks of BLOCKSIZE, the way MODE (the
+// delimiter, and whatever else the test needs) says:
+typedef DArray *(*sample_counter) (const char *buf, size_t len, size_t blocksize, const void *mode);
+
+static const size_t sample_blocksizes[] = { 1, 2, 7, 63, 64, 65, 1000, 4096, SAMPLE_SIZE };
+
+#define SAMPLE_BLOCKSIZES (sizeof(sample_blocksizes) / sizeof(sample_blocksizes[0]))
+#define SAMPLE_OFFSETS 3
+
+// Compare every engine this CPU supports with REFERENCE, counting the first
+// LEN bytes of the sample (less a few, so that it ends anywhere in a
+// vector, and from a few offsets, so that it starts anywhere) in blocks of
+// every size above:
+static inline char *check_engines(sample_counter reference, sample_counter count, const void *mode, size_t len)
+{
+    DArray *expected[SAMPLE_OFFSETS][SAMPLE_BLOCKSIZES];
+    const FC_engine *e = NULL;
+    size_t offset = 0;
+    size_t i = 0;
+    int ok = 1;
+
+    for (offset = 0; offset < SAMPLE_OFFSETS; offset++) {
+        for (i = 0; i < SAMPLE_BLOCKSIZES; i++) {
+            size_t n = len - offset - i * 11;
+            expected[offset][i] = reference(sample + offset, n, n, mode);
+        }
+    }
+
+    for (e = FC_engines; e->name != NULL && ok; e++) {
+        if (!FC_engine_supported(e)) continue;
+        mu_assert(FC_engine_select(e->name) == 0, "failed to select a supported engine");
+
+        for (offset = 0; offset < SAMPLE_OFFSETS && ok; offset++) {
+            for (i = 0; i < SAMPLE_BLOCKSIZES && ok; i++) {
+                DArray *actual = count(sample + offset, len - offset - i * 11, sample_blocksizes[i], mode);
+
+                ok = same_counts(expected[offset][i], actual);
+                if (!ok) debug("engine %s, offset %zu, block size %zu", e->name, offset, sample_blocksizes[i]);
+                FC_array_destroy(actual);
+            }
+        }
+    }
+
+    for (offset = 0; offset < SAMPLE_OFFSETS; offset++) {
+        for (i = 0; i < SAMPLE_BLOCKSIZES; i++) {
+            FC_array_destroy(expected[offset][i]);
+        }
+    }
+
+    mu_assert(ok, "counts differ from the reference counts");
+
+    return NULL;
+}
+
+// Gather the violations reported by a validating count (--expect):
+struct expect_result {
+    unsigned long long count;
+    unsigned long long first_line;
+    unsigned long long first_offset;
+};
+
+static inline int expect_report(void *data, unsigned long long line, unsigned long long offset, unsigned long fieldcount)
+{
+    struct expect_result *r = data;
+
+    (void)fieldcount;
+    if (r->count++ == 0) {
+        r->first_line = line;
+        r->first_offset = offset;
+    }
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,239 @@
+#define SAMPLE_SIZE 100000
+
+#include "fc_sample.h"
+#include <util/fc_hist.h>
+#include <util/fc_scan.h>
+#include <util/fc_parallel.h>
+
+// A straightforward reference: one record per line, counting delimiters:
+static DArray *reference_count(const char *buf, size_t len, size_t blocksize, const void *mode)
+{
+    DArray *darray = DArray_create(sizeof(FCount), 10);
+    char delim = *(const char *)mode;
+    int dc = 0;
+    size_t i = 0;
+
+    (void)blocksize;
+
+    for (i = 0; i < len; i++) {
+        if (buf[i] == delim) dc++;
+        if (buf[i] == '\n') {
+            FC_array_push(darray, dc + 1);
+            dc = 0;
+        }
+    }
+
+    if (len > 0 && buf[len - 1] != '\n') {
+        FC_array_push(darray, dc + 1);
+    }
+
+    return darray;
+}
+
+// Scan the buffer in blocks of the given size:
+static DArray *scan_count(const char *buf, size_t len, size_t blocksize, const void *mode)
+{
+    DArray *darray = DArray_create(sizeof(FCount), 10);
+    FC_hist *hist = FC_hist_create();
+    FC_scan s;
+    size_t i = 0;
+
+    FC_scan_init(&s, *(const unsigned char *)mode);
+
+    for (i = 0; i < len; i += blocksize) {
+        size_t n = (len - i < blocksize) ? len - i : blocksize;
+        FC_scan_block(&s, buf + i, n, hist);
+    }
+
+    FC_scan_finish(&s, hist);
+
+    FC_hist_to_array(hist, darray);
+    FC_hist_destroy(hist);
+
+    return darray;
+}
+
+static char *check_sample(char delim)
+{
+    return check_engines(reference_count, scan_count, &delim, SAMPLE_SIZE);
+}
+
+char *test_engines() {
+    mu_assert(FC_engine_select(NULL) == 0, "no engine selected");
+    mu_assert(FC_engine_current() != NULL, "no current engine");
+    mu_assert(FC_engine_supported(FC_engine_current()), "selected an unsupported engine");
+    mu_assert(FC_engine_select("no-such-engine") != 0, "selected an unknown engine");
+    debug("engine: %s", FC_engine_current()->name);
+
+    return NULL;
+}
+
+char *test_short_lines() {
+    fill_sample("abc\t\t\n");
+    return check_sample('\t');
+}
+
+char *test_long_lines() {
+    fill_sample("abcdefghijklmnopqrstuvwxyz0123456789abcdefghijklmnopqrstuvwxyz0123456789,,,,,,,,,,,,,,,,,,,\n");
+    return check_sample(',');
+}
+
+char *test_nuls() {
+    fill_sample("ab\0|\n?");
+    return check_sample('|');
+}
+
+char *test_newline_delimiter() {
+    fill_sample("ab\n");
+    return check_sample('\n');
+}
+
+char *test_no_trailing_newline() {
+    DArray *darray = scan_count("a,b\nc,d,e", 9, 4, ",");
+
+    mu_assert(darray->end == 2, "expected two distinct field counts");
+    mu_assert(((FCount *)darray->contents[0])->fieldcount == 2, "wrong first field count");
+    mu_assert(((FCount *)darray->contents[1])->fieldcount == 3, "wrong last field count");
+
+    FC_array_destroy(darray);
+
+    return NULL;
+}
+
+char *test_empty() {
+    DArray *darray = scan_count("", 0, 4, ",");
+
+    mu_assert(darray->end == 0, "empty input should have no records");
+
+    FC_array_destroy(darray);
+
+    return NULL;
+}
+
+char *test_expect() {
+    size_t blocksizes[] = { 1, 63, 64, 65, 4096, SAMPLE_SIZE };
+    struct expect_result want = { 0, 0, 0 };
+    unsigned long long line = 0;
+    size_t start = 0;
+    int dc = 0;
+    const FC_engine *e = NULL;
+    size_t i = 0, j = 0;
+
+    fill_sample("abc\t\t\n");
+
+    // The reference: a byte at a time, expecting 3 fields:
+    for (i = 0; i < SAMPLE_SIZE; i++) {
+        if (sample[i] == '\t') dc++;
+        if (sample[i] == '\n' || i == SAMPLE_SIZE - 1) {
+            line++;
+            if (dc + 1 != 3 && want.count++ == 0) {
+                want.first_line = line;
+                want.first_offset = start;
+            }
+            start = i + 1;
+            dc = 0;
+        }
+    }
+
+    for (e = FC_engines; e->name != NULL; e++) {
+        if (!FC_engine_supported(e)) continue;
+        mu_assert(FC_engine_select(e->name) == 0, "failed to select a supported engine");
+
+        for (j = 0; j < sizeof(blocksizes) / sizeof(blocksizes[0]); j++) {
+            struct expect_result got = { 0, 0, 0 };
+            FC_scan s;
+
+            FC_expect_init(&s, '\t', 3, expect_report, &got);
+            for (i = 0; i < SAMPLE_SIZE; i += blocksizes[j]) {
+                size_t n = (SAMPLE_SIZE - i < blocksizes[j]) ? SAMPLE_SIZE - i : blocksizes[j];
+                FC_expect_block(&s, sample + i, n);
+            }
+            FC_expect_finish(&s);
+
+            mu_assert(got.count == want.count, "wrong number of violations");
+            mu_assert(got.first_line == want.first_line, "wrong line of the first violation");
+            mu_assert(got.first_offset == want.first_offset, "wrong offset of the first violation");
+        }
+    }
+
+    return NULL;
+}
+
+char *test_lines() {
+    size_t lengths[] = { 0, 1, 15, 16, 31, 33, 64, 65, 255 * 64 + 7, SAMPLE_SIZE - 3 };
+    const FC_engine *e = NULL;
+    size_t i = 0, j = 0, offset = 0;
+
+    // Mostly newlines, so that the per-byte counters would overflow:
+    fill_sample("\n\n\n\n\n\n\nab");
+
+    for (e = FC_engines; e->name != NULL; e++) {
+        if (!FC_engine_supported(e)) continue;
+        mu_assert(FC_engine_select(e->name) == 0, "failed to select a supported engine");
+
+        for (offset = 0; offset < 3; offset++) {
+            for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+                unsigned long long want = 0;
+
+                for (j = 0; j < lengths[i]; j++) {
+                    if (sample[offset + j] == '\n') want++;
+                }
+
+                mu_assert(FC_scan_lines(sample + offset, lengths[i]) == want, "wrong newline count");
+            }
+        }
+    }
+
+    return NULL;
+}
+
+char *test_parallel() {
+    size_t len = 4 * FC_PARALLEL_MIN_PART + 123;
+    char *buf = malloc(len);
+    size_t i = 0;
+    int ok = 0;
+
+    mu_assert(buf != NULL, "out of memory");
+
+    for (i = 0; i < len; i++) {
+        buf[i] = "ab\t\t\n"[rand() % 5];
+    }
+
+    DArray *expected = reference_count(buf, len, len, "\t");
+    DArray *actual = DArray_create(sizeof(FCount), 10);
+    FC_hist *hist = FC_hist_create();
+
+    FC_parallel_scan(buf, len, '\t', 7, 65536, 0, hist);
+    FC_hist_to_array(hist, actual);
+    ok = same_counts(expected, actual);
+
+    FC_hist_destroy(hist);
+    FC_array_destroy(expected);
+    FC_array_destroy(actual);
+    free(buf);
+
+    mu_assert(ok, "parallel counts differ from the reference counts");
+
+    return NULL;
+}
+
+char *all_tests() {
+    mu_suite_start();
+
+    srand(42);
+
+    mu_run_test(test_engines);
+    mu_run_test(test_short_lines);
+    mu_run_test(test_long_lines);
+    mu_run_test(test_nuls);
+    mu_run_test(test_newline_delimiter);
+    mu_run_test(test_no_trailing_newline);
+    mu_run_test(test_empty);
+    mu_run_test(test_expect);
+    mu_run_test(test_lines);
+    mu_run_test(test_parallel);
+
+    return NULL;
+}
+
+RUN_TESTS(all_tests);
@@ -0,0 +1,207 @@
+#include "fc_sample.h"
+#include <string.h>
+#include <util/fc_hist.h>
+#include <util/fc_scan.h>
+#include <util/fc_csv.h>
+#include <util/fc_sniff.h>
+
+// One candidate of sniffing for DELIMS with QUOTE:
+struct sniff_mode {
+    const char *delims;
+    char quote;
+    int index;                  // in FC_sniff.cand
+    const FC_sniff_candidate *c;
+};
+
+// The reference: what -d or -C count alone, in one block:
+static DArray *reference_count(const char *buf, size_t len, size_t blocksize, const void *mode)
+{
+    const struct sniff_mode *m = mode;
+    DArray *darray = DArray_create(sizeof(FCount), 10);
+    FC_hist *hist = FC_hist_create();
+
+    (void)blocksize;
+
+    if (m->c->csv) {
+        FC_csv csv;
+
+        FC_csv_init(&csv, m->c->delim, m->quote);
+        FC_csv_block(&csv, buf, len, hist);
+        FC_csv_finish(&csv, hist);
+    }
+    else {
+        FC_scan s;
+
+        FC_scan_init(&s, m->c->delim);
+        FC_scan_block(&s, buf, len, hist);
+        FC_scan_finish(&s, hist);
+    }
+
+    FC_hist_to_array(hist, darray);
+    FC_hist_destroy(hist);
+
+    return darray;
+}
+
+// Sniff the buffer in blocks of the given size, and take the counts of one
+// candidate:
+static DArray *sniff_count(const char *buf, size_t len, size_t blocksize, const void *mode)
+{
+    const struct sniff_mode *m = mode;
+    DArray *darray = DArray_create(sizeof(FCount), 10);
+    FC_sniff *s = FC_sniff_create(m->delims, m->quote);
+    size_t i = 0;
+
+    for (i = 0; i < len; i += blocksize) {
+        size_t n = (len - i < blocksize) ? len - i : blocksize;
+        FC_sniff_block(s, buf + i, n);
+    }
+
+    FC_sniff_finish(s);
+    FC_hist_to_array(s->cand[m->index].hist, darray);
+    FC_sniff_destroy(s);
+
+    return darray;
+}
+
+// Compare every candidate of sniffing for DELIMS with its reference:
+static char *check_sample(const char *delims, char quote)
+{
+    FC_sniff *s = FC_sniff_create(delims, quote);
+    struct sniff_mode mode = { delims, quote, 0, NULL };
+    char *msg = NULL;
+
+    mu_assert(s != NULL, "failed to create a sniffer");
+
+    for (mode.index = 0; mode.index < s->ncand && msg == NULL; mode.index++) {
+        mode.c = &s->cand[mode.index];
+        msg = check_engines(reference_count, sniff_count, &mode, SAMPLE_SIZE);
+    }
+
+    FC_sniff_destroy(s);
+
+    return msg;
+}
+
+static char *check_alphabet(const char *alphabet, const char *delims, char quote)
+{
+    fill_sample_from(alphabet, strlen(alphabet));
+
+    return check_sample(delims, quote);
+}
+
+// Fill the sample with ROWS rows of FIELDS fields each, separated by DELIM
+// (and quoted if QUOTED, with a DELIM inside some), and return its length:
+static size_t make_table(int rows, int fields, char delim, int quoted)
+{
+    size_t len = 0;
+    int i = 0;
+    int j = 0;
+
+    for (i = 0; i < rows; i++) {
+        for (j = 0; j < fields; j++) {
+            if (j > 0) sample[len++] = delim;
+            if (quoted) {
+                len += sprintf(sample + len, "\"a%c%d\"", (i + j) % 3 ? ' ' : delim, i + j);
+            }
+            else {
+                len += sprintf(sample + len, "a%d", i + j);
+            }
+        }
+        sample[len++] = '\n';
+    }
+
+    return len;
+}
+
+// The best candidate after sniffing the first LEN bytes of the sample:
+static FC_sniff_candidate best(FC_sniff *s, size_t len)
+{
+    FC_sniff_candidate *ranked[2 * FC_SNIFF_DELIMS];
+
+    FC_sniff_block(s, sample, len);
+    FC_sniff_finish(s);
+    FC_sniff_rank(s, ranked);
+
+    return *ranked[0];
+}
+
+char *test_commas() {
+    return check_alphabet("ab,,\"\n", ",", '"');
+}
+
+char *test_candidates() {
+    char *msg = NULL;
+
+    if ((msg = check_alphabet("abcd,;|\t \"\r\n\n", FC_SNIFF_DEFAULT, '"'))) return msg;
+    if ((msg = check_alphabet("ab,,;  \t'\"\r\n\n", ",; '", '\''))) return msg;
+    if ((msg = check_alphabet("abc,;|:\"\n\n\n", ",;|:ab,", '"'))) return msg;
+
+    return NULL;
+}
+
+// Input without quotes, most of it, and quotes now and then:
+char *test_sparse_quotes() {
+    size_t i = 0;
+
+    for (i = 0; i < SAMPLE_SIZE; i++) {
+        sample[i] = (rand() % 500 == 0) ? '"' : "abc,,;|\t \n"[rand() % 10];
+    }
+
+    return check_sample(FC_SNIFF_DEFAULT, '"');
+}
+
+char *test_rank() {
+    FC_sniff_candidate c;
+    FC_sniff *s = NULL;
+    size_t len = 0;
+
+    mu_assert(FC_engine_select(NULL) == 0, "no engine selected");
+
+    len = make_table(100, 5, '\t', 0);
+    s = FC_sniff_create(FC_SNIFF_DEFAULT, '"');
+    c = best(s, len);
+    mu_assert(c.delim == '\t' && !c.csv, "a TSV file isn't plain with tabs");
+    mu_assert(c.fieldcount == 5 && c.consistent == 100 && c.records == 100, "wrong counts of a TSV file");
+    FC_sniff_destroy(s);
+
+    // Quoted commas only count right as CSV:
+    len = make_table(100, 4, ',', 1);
+    s = FC_sniff_create(FC_SNIFF_DEFAULT, '"');
+    c = best(s, len);
+    mu_assert(c.delim == ',' && c.csv, "a CSV file with quoted commas isn't CSV");
+    mu_assert(c.fieldcount == 4 && c.consistent == 100, "wrong counts of a CSV file");
+    FC_sniff_destroy(s);
+
+    len = make_table(100, 3, ';', 0);
+    s = FC_sniff_create(FC_SNIFF_DEFAULT, '"');
+    c = best(s, len);
+    mu_assert(c.delim == ';' && c.fieldcount == 3, "a file with semicolons isn't split by them");
+    FC_sniff_destroy(s);
+
+    return NULL;
+}
+
+char *test_bad_delimiters() {
+    mu_assert(FC_sniff_create(",\n", '"') == NULL, "a LF was taken for a delimiter");
+    mu_assert(FC_sniff_create("", '"') == NULL, "nothing was taken for delimiters");
+    mu_assert(FC_sniff_create(",;|:abcde", '"') == NULL, "too many delimiters were taken");
+
+    return NULL;
+}
+
+char *all_tests() {
+    mu_suite_start();
+
+    srand(11);
+
+    mu_run_test(test_commas);
+    mu_run_test(test_candidates);
+    mu_run_test(test_sparse_quotes);
+    mu_run_test(test_rank);
+    mu_run_test(test_bad_delimiters);
+
+    return NULL;
+}
+
+RUN_TESTS(all_tests);